@@ -37,7 +37,7 @@ ELAPSED_MATCHER = re.compile(
 
 def feature_rank(dataset, ntrees, f, minsplit=10):
     cmd = ["./build/train_and_test", "-M{}".format(ntrees), "-F{}".format(f),
-           "-N{}".format(minsplit), dataset]
+           "-N{}".format(minsplit), "--cache", dataset]
     out = subprocess.check_output(cmd).decode("ascii")
     frank = out.split("\n")[1:-1]
     frank = "\n".join(map(lambda s: r"\item "+s, frank))
@@ -46,7 +46,7 @@ def feature_rank(dataset, ntrees, f, minsplit=10):
 
 def accuracy_and_time(dataset, ntrees, f, minsplit=4):
     cmd = ["./build/train_and_test", "-M{}".format(ntrees), "-F{}".format(f),
-           "-N{}".format(minsplit), "--cv", "5", dataset]
+           "-N{}".format(minsplit), "--cv", "5", "--cache", dataset]
     out = subprocess.check_output(cmd).decode("ascii")
     out = out.split("\n")[-3:-1]
     out[0] = out[0][10:-1]
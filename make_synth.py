@@ -0,0 +1,37 @@
+#!/usr/bin/python3
+
+"""Generates Data/synth, a synthetic data set with many numeric records.
+
+It is used to time the training of large forests (e.g. the split searches
+and the CSV reader); it is not committed since it is fully determined by
+this script.
+"""
+
+import os
+import random
+
+NRECORDS = 20000
+NATTRIBUTES = 10
+FOLDER = os.path.join("Data", "synth")
+
+
+def main():
+    random.seed(1)
+    os.makedirs(FOLDER, exist_ok=True)
+    with open(os.path.join(FOLDER, "synth.data"), "w") as f:
+        for _ in range(NRECORDS):
+            x = [random.gauss(0, 1) for _ in range(NATTRIBUTES)]
+            if x[0] + 0.5*x[1] - x[2]*x[3] + random.gauss(0, 0.5) > 0:
+                c = "a"
+            else:
+                c = "b" if x[4] > 0.3 else "c"
+            f.write(",".join("%.4f" % v for v in x) + "," + c + "\n")
+    with open(os.path.join(FOLDER, "synth.meta"), "w") as f:
+        f.write("%d\n" % (NATTRIBUTES + 1))
+        for j in range(NATTRIBUTES):
+            f.write("Real x%d\n" % j)
+        f.write("Nominal class\nclass\n")
+
+
+if __name__ == "__main__":
+    main()
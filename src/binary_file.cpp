@@ -0,0 +1,94 @@
+#include "binary_file.h"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sel
+{
+
+MappedFile::MappedFile(const std::string& filename) :
+  addr_(MAP_FAILED), size_(0)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd >= 0 and fstat(fd, &st) == 0 and st.st_size > 0)
+  {
+    size_ = st.st_size;
+    addr_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (fd >= 0) close(fd);
+  if (addr_ == MAP_FAILED)
+  {
+    throw SelException(std::string("File ")+filename+" cannot be loaded");
+  }
+}
+
+MappedFile::MappedFile(const std::string& filename, std::size_t size) :
+  addr_(MAP_FAILED), size_(size)
+{
+  int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0 and ftruncate(fd, size) == 0)
+  {
+    addr_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (fd >= 0) close(fd);
+  if (addr_ == MAP_FAILED)
+  {
+    throw SelException(std::string("File ")+filename+" cannot be written");
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  munmap(addr_, size_);
+}
+
+std::uint64_t checksum(const std::string& filename)
+{
+  std::ifstream in(filename, std::ios::binary);
+  if (not in) throw SelException(std::string("Error opening ") + filename);
+  std::vector<char> block(1 << 20);
+  std::uint64_t hash = 0x9e3779b97f4a7c15ULL, size = 0;
+  while (in)
+  {
+    in.read(block.data(), block.size());
+    std::size_t count = in.gcount();
+    /* The last word is padded with zeros (the size is hashed too). */
+    std::size_t padded = align(count, 8);
+    std::memset(block.data() + count, 0, padded - count);
+    for (std::size_t idx = 0; idx < padded; idx += 8)
+    {
+      std::uint64_t word;
+      std::memcpy(&word, block.data() + idx, 8);
+      hash = (hash ^ word)*0xff51afd7ed558ccdULL;
+      hash ^= hash >> 32;
+    }
+    size += count;
+  }
+  if (in.bad()) throw SelException(std::string("Error reading ") + filename);
+  return hash ^ size;
+}
+
+void check_little_endian()
+{
+  std::uint16_t one = 1;
+  if (*reinterpret_cast<const char*>(&one) != 1)
+  {
+    throw SelException("Binary files need a little-endian host");
+  }
+}
+
+void write_string(std::ostream& out, const std::string& str)
+{
+  std::uint32_t length = str.size();
+  write(out, &length, 1);
+  write(out, str.data(), length);
+}
+
+} /* end namespace sel */
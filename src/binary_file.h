@@ -0,0 +1,139 @@
+#ifndef BINARY_FILE_H
+#define BINARY_FILE_H
+
+#include "common.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace sel
+{
+
+/**
+ * @brief Memory mapping of a whole file, unmapped on destruction.
+ */
+class MappedFile
+{
+  public:
+
+    /**
+     * @brief Maps an existing file for reading (throws SelException if it
+     * cannot be mapped).
+     */
+    explicit MappedFile(const std::string& filename);
+
+    /**
+     * @brief Creates (or truncates) a file of the given size and maps it for
+     * writing. Changes reach the file as the pages are written back.
+     */
+    MappedFile(const std::string& filename, std::size_t size);
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    const char* data() const { return static_cast<const char*>(addr_); }
+
+    char* data() { return static_cast<char*>(addr_); }
+
+    std::size_t size() const { return size_; }
+
+  private:
+
+    void* addr_;
+    std::size_t size_;
+};
+
+/**
+ * @brief Bounds-checked sequential access to a mapped file.
+ */
+class BinaryReader
+{
+  public:
+
+    /**
+     * @param what Kind of contents of the file, for error messages (e.g.
+     * "model").
+     */
+    BinaryReader(const MappedFile& file, const std::string& filename,
+        const std::string& what) :
+      data_(file.data()), size_(file.size()), offset_(0),
+      filename_(filename), what_(what) {}
+
+    /**
+     * @return Pointer to the next count values of type T, within the
+     * mapping (throws SelException if the file ends before).
+     */
+    template <typename T>
+    const T* read(std::size_t count)
+    {
+      if ((size_ - offset_)/sizeof(T) < count) corrupt();
+      const T* ret = reinterpret_cast<const T*>(data_ + offset_);
+      offset_ += count*sizeof(T);
+      return ret;
+    }
+
+    std::string read_string()
+    {
+      std::uint32_t length = *read<std::uint32_t>(1);
+      return std::string(read<char>(length), length);
+    }
+
+    void align(std::size_t alignment)
+    {
+      offset_ = std::min(size_, (offset_ + alignment - 1)/alignment*alignment);
+    }
+
+    std::size_t get_offset() const { return offset_; }
+
+    void corrupt() const
+    {
+      throw SelException(std::string("File ")+filename_+" is not a valid "+
+          what_);
+    }
+
+  private:
+
+    const char* data_;
+    std::size_t size_, offset_;
+    std::string filename_, what_;
+};
+
+/**
+ * @return Hash of the contents of a file, to detect whether it changed
+ * (throws SelException if it cannot be read).
+ */
+std::uint64_t checksum(const std::string& filename);
+
+/**
+ * @brief Throws SelException unless the host is little-endian, the byte
+ * order of all the binary formats.
+ */
+void check_little_endian();
+
+template <typename T>
+void write(std::ostream& out, const T* values, std::size_t count)
+{
+  out.write(reinterpret_cast<const char*>(values), count*sizeof(T));
+}
+
+/**
+ * @brief Writes the length of str (uint32) followed by its characters.
+ */
+void write_string(std::ostream& out, const std::string& str);
+
+/**
+ * @return offset rounded up to a multiple of alignment.
+ */
+inline std::size_t align(std::size_t offset, std::size_t alignment)
+{
+  return (offset + alignment - 1)/alignment*alignment;
+}
+
+} /* end namespace sel */
+
+#endif
@@ -1,5 +1,12 @@
 #include "common.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace sel
 {
 
@@ -8,6 +15,71 @@ std::ostream& operator<<(std::ostream& os, const Stringifiable& strable)
   return os << strable.to_str();
 }
 
+double parse_number(const char* first, const char* last)
+{
+  /* Powers of ten that are exact doubles. */
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+    1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char* p = first;
+  bool negative = p != last and *p == '-';
+  if (p != last and (*p == '-' or *p == '+')) ++p;
+  std::uint64_t mantissa = 0;
+  int ndigits = 0, exponent = 0;
+  bool any = false;
+  for (; p != last and unsigned(*p - '0') < 10; ++p, any = true)
+  {
+    if (mantissa == 0 and *p == '0') continue;
+    if (++ndigits <= 19) mantissa = mantissa*10 + (*p - '0');
+  }
+  if (p != last and *p == '.')
+  {
+    for (++p; p != last and unsigned(*p - '0') < 10; ++p, any = true)
+    {
+      if (mantissa == 0 and *p == '0')
+      {
+        --exponent;
+        continue;
+      }
+      if (++ndigits <= 19) mantissa = mantissa*10 + (*p - '0');
+      --exponent;
+    }
+  }
+  if (any and p != last and (*p == 'e' or *p == 'E'))
+  {
+    const char* q = p + 1;
+    bool negative_exp = q != last and *q == '-';
+    if (q != last and (*q == '-' or *q == '+')) ++q;
+    int value = 0;
+    const char* digits = q;
+    for (; q != last and unsigned(*q - '0') < 10; ++q)
+    {
+      if (value < 10000) value = value*10 + (*q - '0');
+    }
+    if (q != digits)
+    {
+      exponent += negative_exp? -value : value;
+      p = q;
+    }
+  }
+  /* Clinger's fast path: both the mantissa and the power of ten are exact,
+   * so the result is correctly rounded. */
+  if (any and p == last and ndigits <= 15 and -22 <= exponent and
+      exponent <= 22)
+  {
+    double number = mantissa;
+    number = exponent < 0? number / powers[-exponent] :
+                           number * powers[exponent];
+    return negative? -number : number;
+  }
+  std::string str(first, last);
+  char* end;
+  double number = std::strtod(str.c_str(), &end);
+  if (end == str.c_str()) throw SelException("Not a number: " + str);
+  return number;
+}
+
 Value::Ptr Value::create(const std::string& value, bool numeric)
 {
   Value::Ptr ret;
@@ -15,7 +87,10 @@ Value::Ptr Value::create(const std::string& value, bool numeric)
   {
     ret.reset(numeric? (Value*)new Number() : (Value*)new Category());
   }
-  else if (numeric) ret.reset(new Number(std::stod(value)));
+  else if (numeric)
+  {
+    ret.reset(new Number(parse_number(value.data(), value.data()+value.size())));
+  }
   else ret.reset(new Category(value));
   return ret;
 }
@@ -25,5 +100,51 @@ std::string Number::to_str() const
   return is_missing()? std::string("?") : std::to_string(number_);
 }
 
+Rng::Rng(std::uint64_t seed, std::uint64_t stream)
+  : key_(mix(mix(seed) ^ mix(stream + gamma))), counter_(0)
+{
+}
+
+std::uint64_t Rng::uniform(std::uint64_t n)
+{
+  /* Reject the lowest (2^64 mod n) outputs so all residues are equally
+   * likely. */
+  std::uint64_t threshold = (0 - n) % n;
+  std::uint64_t x;
+  do x = (*this)(); while (x < threshold);
+  return x % n;
+}
+
+void parallel_for(int n, int threads, const std::function<void(int)>& task)
+{
+  if (threads <= 0) threads = std::thread::hardware_concurrency();
+  threads = std::max(1, std::min(threads, n));
+  std::atomic<int> next(0);
+  std::exception_ptr error;
+  std::mutex error_mtx;
+  auto worker = [&]()
+  {
+    int idx;
+    while ((idx = next++) < n)
+    {
+      try
+      {
+        task(idx);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(error_mtx);
+        if (not error) error = std::current_exception();
+        next = n; // stop handing out tasks
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int idx = 1; idx < threads; ++idx) pool.emplace_back(worker);
+  worker(); // the calling thread also takes part
+  for (auto& thread : pool) thread.join();
+  if (error) std::rethrow_exception(error);
+}
+
 } /* end namespace sel */
 
@@ -8,7 +8,9 @@
 #define COMMON_H
 
 #include <cmath>
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <unordered_map>
 #include <memory>
 #include <limits>
@@ -26,6 +28,7 @@ const double inf = std::numeric_limits<double>::infinity();
 
 class Stringifiable;
 class SelException;
+class Rng;
 class Value;
 class Number;
 class Category;
@@ -69,6 +72,83 @@ class SelException
 
 };
 
+/** 
+ * @brief Parses a decimal number, like std::stod in the "C" locale but
+ * without copying the characters in the common case.
+ *
+ * Numbers with up to 15 significant digits and small exponents are converted
+ * exactly with a single multiplication or division; others fall back to
+ * std::strtod.
+ * 
+ * @param first Beginning of the number.
+ * @param last End of the number (the characters need not be null-terminated).
+ * 
+ * @return The number (trailing characters are ignored, as in std::stod).
+ *
+ * @throw SelException if the characters do not start with a number.
+ */
+double parse_number(const char* first, const char* last);
+
+/** 
+ * @brief Counter-based, splittable pseudo-random generator.
+ *
+ * The n-th output is a (SplitMix64) hash of the key of the stream plus n, so
+ * generators are cheap to create and independent streams can be derived
+ * deterministically from a parent generator (e.g. one per tree), no matter
+ * which thread ends up using them. It satisfies the requirements of a
+ * UniformRandomBitGenerator.
+ */
+class Rng
+{
+  public:
+
+    typedef std::uint64_t result_type;
+
+    /** 
+     * @param seed Seed of the generator.
+     * @param stream Identifier of the stream, for generators that share seed.
+     */
+    explicit Rng(std::uint64_t seed=0, std::uint64_t stream=0);
+
+    /** 
+     * @param stream Identifier of the child stream.
+     * 
+     * @return A new generator, independent from this one (and from children
+     * with different stream identifiers). It does not alter this generator.
+     */
+    Rng split(std::uint64_t stream) const { return Rng(key_, stream); }
+
+    result_type operator()() { return mix(key_ + ++counter_*gamma); }
+
+    /** 
+     * @param n Upper bound (exclusive). Must be positive.
+     * 
+     * @return Unbiased random integer in [0, n).
+     */
+    std::uint64_t uniform(std::uint64_t n);
+
+    static constexpr result_type min() { return 0; }
+
+    static constexpr result_type max()
+    {
+      return std::numeric_limits<result_type>::max();
+    }
+
+  private:
+
+    static const std::uint64_t gamma = 0x9e3779b97f4a7c15ULL;
+
+    static std::uint64_t mix(std::uint64_t z)
+    {
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+
+    std::uint64_t key_;
+    std::uint64_t counter_;
+};
+
 /** 
  * @brief Represents attribute values (either number or categories).
  */
@@ -300,6 +380,20 @@ std::string container2str(const Container& ctn, const std::string& open="[",
  */
 std::ostream& operator<<(std::ostream& os, const Stringifiable& strable);
 
+/** 
+ * @brief Runs task(0), ..., task(n-1) on a pool of worker threads.
+ *
+ * Tasks are handed out to the workers one at a time, so the order in which
+ * they are executed is not specified. The first exception thrown by a task
+ * (if any) is rethrown in the calling thread once all the workers are done.
+ * 
+ * @param n Number of tasks.
+ * @param threads Number of worker threads. If <= 0, as many as hardware
+ * threads are available.
+ * @param task Callable invoked with the index of each task.
+ */
+void parallel_for(int n, int threads, const std::function<void(int)>& task);
+
 } /* end namespace sel*/
 
 #endif
@@ -0,0 +1,117 @@
+#include "tree.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#ifndef DATA_PATH
+#define DATA_PATH "../Data/"
+#endif
+
+namespace
+{
+
+/* Seconds taken by the split search of every attribute of data, repeated. */
+template <class Criterion>
+double time_stumps(const sel::Dataframe& data, const Criterion& criterion,
+    int repetitions, double& m_sum)
+{
+  auto start = std::chrono::steady_clock::now();
+  m_sum = 0;
+  for (int rep = 0; rep < repetitions; ++rep)
+  {
+    for (int column = 0; column < data.get_nattributes(); ++column)
+    {
+      if (column == data.get_target_idx()) continue;
+      sel::DecisionStump::Ptr stump;
+      if (data.get_attribute(column).numeric)
+      {
+        stump.reset(new sel::NumericDecisionStump(data, column, criterion));
+      }
+      else
+      {
+        stump.reset(new sel::CategoricalDecisionStump(data, column,
+              criterion));
+      }
+      if (stump->get_m() != sel::inf) m_sum += stump->get_m();
+    }
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+/* Rounds of timings of each variant; the best one is reported. */
+const int rounds = 5;
+
+/* Compares the inlined criterion with the indirect call to its Metric, and
+ * returns whether both give the same impurities. After a warm-up run of
+ * each, the two are timed in alternating order for a number of rounds, so
+ * that neither always runs first. */
+template <class Criterion>
+bool compare(const std::string& name, const sel::Dataframe& data,
+    const Criterion& criterion, sel::Metric metric, int repetitions)
+{
+  sel::MetricCriterion indirect(metric);
+  double m_inline, m_indirect;
+  time_stumps(data, criterion, 1, m_inline);
+  time_stumps(data, indirect, 1, m_indirect);
+  double inline_time = sel::inf, indirect_time = sel::inf;
+  for (int round = 0; round < rounds; ++round)
+  {
+    if (round%2 == 0)
+    {
+      inline_time = std::min(inline_time,
+          time_stumps(data, criterion, repetitions, m_inline));
+    }
+    indirect_time = std::min(indirect_time,
+        time_stumps(data, indirect, repetitions, m_indirect));
+    if (round%2 == 1)
+    {
+      inline_time = std::min(inline_time,
+          time_stumps(data, criterion, repetitions, m_inline));
+    }
+  }
+  bool same = std::abs(m_inline - m_indirect) <=
+    1e-9*std::max(std::abs(m_inline), std::abs(m_indirect));
+  std::cout << name << ": policy " << inline_time << " s, metric "
+    << indirect_time << " s, speedup " << indirect_time/inline_time
+    << " (sum of impurities " << m_inline << " vs " << m_indirect
+    << (same? "" : ", MISMATCH") << ")\n";
+  return same;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2 and argc != 3)
+  {
+    std::cerr << "Usage: " << argv[0] << " datasetname [repetitions]\n";
+    return -1;
+  }
+  try
+  {
+    std::string datafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".data";
+    std::string metafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".meta";
+    int repetitions = argc == 3? std::stoi(argv[2]) : 20;
+
+    sel::Table table(datafile, metafile);
+    std::cout << argv[1] << ": " << table.get_nrecords() << " records, "
+      << table.get_nattributes() << " attributes, best of " << rounds
+      << " rounds of " << repetitions << " repetitions\n";
+
+    bool same = compare("gini", table, sel::GiniCriterion(), sel::gini,
+        repetitions);
+    same = compare("entropy", table, sel::EntropyCriterion(), sel::entropy,
+        repetitions) and same;
+    same = compare("error", table, sel::ErrorCriterion(), sel::error,
+        repetitions) and same;
+    if (not same) return 1;
+  }
+  catch (sel::SelException& ex)
+  {
+    std::cerr << ex.what() << '\n';
+    return 1;
+  }
+}
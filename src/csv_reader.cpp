@@ -1,60 +1,117 @@
 #include "csv_reader.h"
 
-#include <cctype>
+#include <cstring>
 #include <iostream>
+#include <limits>
 
 namespace sel
 {
 
-namespace /* utils for internal usage */
-{
+const std::size_t CsvReader::block_size;
 
-// parsing is easier if we make sure that there are no whitespaces
-void remove_blanks(const std::string& line, std::string& clean_line)
+CsvReader::CsvReader(const std::string& filename, char delim)
+  : in_(filename, std::ios::binary), delim_(delim), buffer_(block_size),
+    begin_(0), end_(0), offset_(0),
+    limit_(std::numeric_limits<std::streamoff>::max())
 {
-  clean_line.clear();
-  clean_line.reserve(line.length());
-  for (char c : line)
+  if (not in_)
   {
-    if (not isblank(c)) clean_line.push_back(c);
+    throw SelException(std::string("Error opening ") + filename);
   }
 }
 
-void split(const std::string& line, CsvRow& row, char delim=',')
+CsvReader::CsvReader(const std::string& filename, std::streamoff begin,
+    std::streamoff end, char delim) : CsvReader(filename, delim)
 {
-  std::size_t pos = 0;
-  std::size_t next;
-  while ((next = line.find_first_of(delim, pos)) != std::string::npos)
+  limit_ = end;
+  if (begin > 0)
   {
-    row.push_back(line.substr(pos, next-pos));
-    pos = next + 1;
+    /* The row that contains byte begin-1 belongs to the previous reader */
+    offset_ = begin - 1;
+    in_.seekg(offset_);
+    char* line;
+    std::size_t length;
+    next_line(line, length);
   }
-  row.push_back(line.substr(pos));
 }
 
-} /* end anonymous namespace */
+bool CsvReader::next_row(CsvRow& row)
+{
+  CsvFields fields;
+  bool ret = next_row(fields);
+  row.clear();
+  for (const CsvField& field : fields) row.push_back(field.str());
+  return ret;
+}
 
-CsvReader::CsvReader(const std::string& filename, char delim)
-  : in_(filename), delim_(delim)
+bool CsvReader::next_row(CsvFields& row)
 {
-  if (not in_)
+  row.clear();
+  char* line;
+  std::size_t length;
+  while (row.empty() and next_line(line, length))
   {
-    throw SelException(std::string("Error opening ") + filename);
+    /* Parsing is easier if we make sure that there are no whitespaces, so
+     * blanks are removed by shifting the rest of the line in place. */
+    char* out = line;
+    char* field = line;
+    bool empty = true;
+    for (char* p = line; p != line + length; ++p)
+    {
+      if (*p == ' ' or *p == '\t') continue;
+      empty = false;
+      if (*p == delim_)
+      {
+        row.push_back(CsvField{field, std::size_t(out - field)});
+        field = out;
+      }
+      else *out++ = *p;
+    }
+    if (not empty) row.push_back(CsvField{field, std::size_t(out - field)});
   }
+  return not row.empty();
 }
 
-bool CsvReader::next_row(CsvRow& row)
+bool CsvReader::next_line(char*& line, std::size_t& length)
 {
-  row.clear();
-  std::string line, clean_line;
-  while (row.empty() and std::getline(in_, line))
+  if (offset_ + std::streamoff(begin_) >= limit_) return false;
+  std::size_t scanned = begin_;
+  while (true)
   {
-    remove_blanks(line, clean_line);
-    if (not clean_line.empty()) split(clean_line, row, delim_);
+    char* data = buffer_.data();
+    char* newline = (char*) std::memchr(data + scanned, '\n', end_ - scanned);
+    if (newline)
+    {
+      line = data + begin_;
+      length = newline - line;
+      begin_ = newline - data + 1;
+      return true;
+    }
+    if (not in_)
+    {
+      /* Last line, without a line break */
+      if (begin_ == end_) return false;
+      line = data + begin_;
+      length = end_ - begin_;
+      begin_ = end_;
+      return true;
+    }
+    scanned = end_ - begin_;
+    fill();
   }
-  return (bool) in_;
 }
 
-} /* end namespace rise */
-
+void CsvReader::fill()
+{
+  std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+  offset_ += begin_;
+  end_ -= begin_;
+  begin_ = 0;
+  /* The line does not fit in the buffer */
+  if (end_ == buffer_.size()) buffer_.resize(2*buffer_.size());
+  in_.read(buffer_.data() + end_, buffer_.size() - end_);
+  end_ += in_.gcount();
+  if (in_.bad()) throw SelException("Error reading CSV file");
+}
 
+} /* end namespace rise */
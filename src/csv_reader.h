@@ -9,6 +9,7 @@
 
 #include "common.h"
 
+#include <cstddef>
 #include <fstream>
 #include <vector>
 
@@ -18,8 +19,26 @@ namespace sel
 typedef std::vector<std::string> CsvRow;
 class CsvReader;
 
+/** 
+ * @brief Characters of a field, within the buffer of a CsvReader.
+ */
+struct CsvField
+{
+  const char* data;
+  std::size_t size;
+
+  std::string str() const { return std::string(data, size); }
+
+  bool is_missing() const { return size == 1 and *data == '?'; }
+};
+
+typedef std::vector<CsvField> CsvFields;
+
 /** 
  * @brief Provides a very simple interface to parse CSV files.
+ *
+ * The file is read in large blocks and the rows are tokenized in place, so
+ * reading the fields of a row neither copies nor allocates.
  */
 class CsvReader
 {
@@ -33,6 +52,14 @@ class CsvReader
      */
     CsvReader(const std::string& filename, char delim=',');
 
+    /** 
+     * @brief Reader of the rows that start within bytes [begin, end) of the
+     * file, so that a file split at arbitrary offsets is read by several
+     * readers without missing or repeating rows.
+     */
+    CsvReader(const std::string& filename, std::streamoff begin,
+        std::streamoff end, char delim=',');
+
     /** 
      * @brief Main method to read rows from the CSV file line by line.
      * 
@@ -43,10 +70,33 @@ class CsvReader
      */
     bool next_row(CsvRow& row);
 
+    /** 
+     * @brief Same as next_row(CsvRow&), without copying the fields.
+     * 
+     * @param row The fields of the new row, valid until the next call.
+     */
+    bool next_row(CsvFields& row);
+
   private:
 
+    /* Size of the blocks read from the file. */
+    static const std::size_t block_size = 1 << 20;
+
+    /* Finds the next line in the buffer, reading more blocks if needed. */
+    bool next_line(char*& line, std::size_t& length);
+
+    /* Reads a block after the unread characters of the buffer. */
+    void fill();
+
     std::ifstream in_;
     char delim_;
+    std::vector<char> buffer_;
+    /* Unread characters of the buffer. */
+    std::size_t begin_;
+    std::size_t end_;
+    /* Offset in the file of the buffer, and of the end of the last row. */
+    std::streamoff offset_;
+    std::streamoff limit_;
 };
 
 
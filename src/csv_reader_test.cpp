@@ -1,4 +1,5 @@
 #include "csv_reader.h"
+#include <fstream>
 #include <iostream>
 
 #ifndef DATA_PATH
@@ -20,6 +21,7 @@ int main(int argc, char* argv[])
     std::string path = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".data";
     sel::CsvReader reader(path);
     sel::CsvRow row;
+    std::vector<sel::CsvRow> rows;
     int nrecords = 0;
     while (reader.next_row(row))
     {
@@ -27,8 +29,26 @@ int main(int argc, char* argv[])
       if (columns == -1) columns = row.size();
       else if (columns != (int)row.size()) std::cerr << "Warning! number of columns not consistent\n";
       std::cout << sel::container2str(row) << std::endl;
+      rows.push_back(row);
     }
     std::cout << "#Records: " << nrecords << "; #Attributes: " << columns << std::endl;
+
+    /* Readers of consecutive byte ranges, split at arbitrary offsets, read
+     * each row once, in order. */
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    std::streamoff size = file.tellg();
+    const int nchunks = 7;
+    std::vector<sel::CsvRow> chunked;
+    for (int chunk = 0; chunk < nchunks; ++chunk)
+    {
+      sel::CsvReader chunk_reader(path, size*chunk/nchunks,
+          size*(chunk+1)/nchunks);
+      while (chunk_reader.next_row(row)) chunked.push_back(row);
+    }
+    bool same = chunked == rows;
+    std::cout << "Reading in " << nchunks << " chunks matches: "
+      << (same? "yes" : "no") << std::endl;
+    if (not same) return 1;
   }
   catch (sel::SelException& ex)
   {
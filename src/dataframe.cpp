@@ -1,7 +1,15 @@
 #include "dataframe.h"
+#include "binary_file.h"
 
 #include <algorithm>
-#include <cstdlib>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
+#include <unistd.h>
 
 namespace sel
 {
@@ -16,83 +24,131 @@ int clip(int x, int lo, int up)
   return x;
 }
 
+void shuffle_rows(int* begin, int* end, Rng& rng)
+{
+  for (int idx = (int)(end-begin)-1; idx > 0; --idx)
+  {
+    int jdx = rng.uniform(idx+1);
+    std::swap(begin[idx], begin[jdx]);
+  }
+}
+
+void sort_rows(const Table& root, int column, int* begin, int* end)
+{
+  const Column& col = root.get_column(column);
+  if (root.get_attribute(column).numeric)
+  {
+    auto cmp = [&col](int a, int b) { return col.numbers[a] < col.numbers[b]; };
+    std::sort(begin, end, cmp);
+  }
+  else
+  {
+    auto cmp = [&col](int a, int b)
+    {
+      return col.dictionary.decode(col.codes[a]) <
+             col.dictionary.decode(col.codes[b]);
+    };
+    std::sort(begin, end, cmp);
+  }
+}
+
 } /* end anonymous namespace */
 
+////////////////////
+// Dictionary methods
+////////////////////
+
+Code Dictionary::encode(const std::string& category)
+{
+  auto it = codes_.find(category);
+  if (it != codes_.end()) return it->second;
+  Code code = categories_.size();
+  categories_.push_back(category);
+  codes_[category] = code;
+  return code;
+}
+
+long Dictionary::find(const std::string& category) const
+{
+  auto it = codes_.find(category);
+  return it != codes_.end()? (long)it->second : -1;
+}
+
 ///////////////////
 // Instance methods
 ///////////////////
 
-Instance::Instance(const Instance& other)
+int Instance::get_index() const
 {
-  copy(other);
+  return table_->indices_[row_];
 }
 
-Instance& Instance::operator=(const Instance& other)
+bool Instance::is_missing(int idx) const
 {
-  copy(other);
-  return *this;
+  return table_->columns_.at(idx).missing[row_];
 }
 
-const Value& Instance::get(const std::string& attr) const
+double Instance::get_number(int idx) const
 {
-  return get(dataframe_->get_attribute_idx(attr));
+  if (not table_->get_attribute(idx).numeric)
+  {
+    throw SelException("Not a number");
+  }
+  return table_->columns_[idx].numbers[row_];
 }
 
-const Value& Instance::get(const Attribute& attr) const
+Code Instance::get_code(int idx) const
 {
-  return get(dataframe_->get_attribute_idx(attr));
+  if (table_->get_attribute(idx).numeric)
+  {
+    throw SelException("Not a category");
+  }
+  return table_->columns_[idx].codes[row_];
 }
 
-void Instance::set(int idx, Value::Ptr&& value)
+const std::string& Instance::get_category(int idx) const
 {
-  values_[idx] = std::move(value);
+  return table_->columns_[idx].dictionary.decode(get_code(idx));
 }
 
-void Instance::set(const std::string& attr, Value::Ptr&& value)
+void Instance::set(int idx, const Value& value)
 {
-  values_[dataframe_->get_attribute_idx(attr)] = std::move(value);
+  Column& column = table_->columns_.at(idx);
+  if (table_->get_attribute(idx).numeric)
+  {
+    column.numbers.mutable_data()[row_] = value.get_number();
+  }
+  else
+  {
+    column.codes.mutable_data()[row_] =
+      column.dictionary.encode(value.get_category());
+  }
+  column.missing.mutable_data()[row_] = value.is_missing();
 }
 
-void Instance::set(const Attribute& attr, Value::Ptr&& value)
+void Instance::set(const std::string& attr, const Value& value)
 {
-  values_[dataframe_->get_attribute_idx(attr)] = std::move(value);
+  set(table_->get_attribute_idx(attr), value);
 }
 
-void Instance::swap(Instance& other)
+void Instance::set(const Attribute& attr, const Value& value)
 {
-  std::swap(idx_, other.idx_);
-  values_.swap(other.values_);
+  set(table_->get_attribute_idx(attr), value);
 }
 
 std::string Instance::to_str() const
 {
   std::vector<std::string> out;
-  out.reserve(values_.size());
-  for (const Value::Ptr& value : values_)
-  {
-    out.push_back(value->to_str());
-  }
-  return std::to_string(idx_) + ": " + container2str(out);
-}
-
-void Instance::init(const Dataframe* dataframe, int idx, const CsvRow& row)
-{
-  dataframe_ = dataframe;
-  idx_ = idx;
-  values_.resize(row.size());
-  for (int jdx = 0; jdx < dataframe_->get_nattributes(); ++jdx)
+  out.reserve(table_->get_nattributes());
+  for (int idx = 0; idx < table_->get_nattributes(); ++idx)
   {
-    bool numeric = dataframe->get_attribute(jdx).numeric;
-    values_[jdx] = std::move(Value::create(row[jdx], numeric));
+    if (table_->get_attribute(idx).numeric)
+    {
+      out.push_back(Number(get_number(idx)).to_str());
+    }
+    else out.push_back(get_category(idx));
   }
-}
-
-void Instance::copy(const Instance& other)
-{
-  idx_ = other.idx_;
-  dataframe_ = other.dataframe_;
-  values_.clear();
-  for (const auto& value : other.values_) values_.push_back(value->clone());
+  return std::to_string(get_index()) + ": " + container2str(out);
 }
 
 ////////////////////
@@ -108,14 +164,45 @@ int Dataframe::get_attribute_idx(const std::string& name) const
   throw SelException(std::string("Non-existent attribute: ") + name);
 }
 
+const Dataframe::Weights& Dataframe::get_weights() const
+{
+  static const Weights unweighted;
+  return unweighted;
+}
+
+double Dataframe::get_total_weight() const
+{
+  const Weights& weights = get_weights();
+  if (not weights) return get_nrecords();
+  double total = 0;
+  for (int idx = 0; idx < get_nrecords(); ++idx)
+  {
+    total += (*weights)[get_row(idx)];
+  }
+  return total;
+}
+
+Instance Dataframe::operator[](int idx)
+{
+  /* It's OK! Instances are the only way to modify the root table. */
+  return Instance(const_cast<Table*>(&get_root()), get_row(idx));
+}
+
+const Instance Dataframe::get_instance(int idx) const
+{
+  return Instance(const_cast<Table*>(&get_root()), get_row(idx));
+}
+
 int Dataframe::get_nmissing() const
 {
   int count = 0;
-  for (int idx = 0; idx < get_nrecords(); ++idx)
+  for (int jdx = 0; jdx < get_nattributes(); ++jdx)
   {
-    for (int jdx = 0; jdx < get_nattributes(); ++jdx)
+    const ColumnData<std::uint8_t>& missing =
+      get_root().get_column(jdx).missing;
+    for (int idx = 0; idx < get_nrecords(); ++idx)
     {
-      if (get_instance(idx).get(jdx).is_missing()) ++count;
+      if (missing[get_row(idx)]) ++count;
     }
   }
   return count;
@@ -131,18 +218,21 @@ double Dataframe::get_pmissing() const
 void Dataframe::category_freq(int column, CategoryFrequency& density,
     bool normalize) const
 {
-  density.clear();
+  if (get_attribute(column).numeric) throw SelException("Not a category");
+  const Column& col = get_root().get_column(column);
+  const Weights& weights = get_weights();
+  density.assign(col.dictionary.size(), 0);
+  double total = 0;
   for (int idx = 0; idx < get_nrecords(); ++idx)
   {
-    const Value& curr = get_instance(idx).get(column);
-    density[curr.get_category()] += 1;
+    int row = get_row(idx);
+    double weight = weights? (*weights)[row] : 1;
+    density[col.codes[row]] += weight;
+    total += weight;
   }
   if (normalize)
   {
-    for (auto& entry : density)
-    {
-      entry.second /= get_nrecords();
-    }
+    for (double& freq : density) freq /= total;
   }
 }
 
@@ -156,10 +246,12 @@ void Dataframe::category_freq(const std::string& column,
 double Dataframe::aggregate(int column,
     std::function<double(double,double)> aggregator, double acc) const
 {
+  if (not get_attribute(column).numeric) throw SelException("Not a number");
+  const Column& col = get_root().get_column(column);
   for (int idx = 0; idx < get_nrecords(); ++idx)
   {
-    const Value& curr = get_instance(idx).get(column);
-    if (not curr.is_missing()) acc = aggregator(acc, curr.get_number());
+    int row = get_row(idx);
+    if (not col.missing[row]) acc = aggregator(acc, col.numbers[row]);
   }
   return acc;
 }
@@ -233,31 +325,21 @@ void Dataframe::sort_by_column(const std::string& column)
 
 void Dataframe::partition(int column, Partition& part) const
 {
-  part.clear();
-  if (empty()) return;
-  View sorted(const_cast<Dataframe&>(*this)); /* It's OK! The view won't change this object. */
-  sorted.sort_by_column(column);
-  std::vector<int> transitions;
-  for (int idx = 1; idx < sorted.get_nrecords(); ++idx)
-  {
-    const Value& prev = sorted.get_instance(idx-1).get(column);
-    const Value& curr = sorted.get_instance(idx).get(column);
-    if (prev != curr) transitions.push_back(idx);
-  }
-  int last_transition = 0;
-  for (int transition : transitions)
+  if (get_attribute(column).numeric) throw SelException("Not a category");
+  const Column& col = get_root().get_column(column);
+  std::vector<std::vector<int>> rows(col.dictionary.size());
+  for (int idx = 0; idx < get_nrecords(); ++idx)
   {
-    const Value& val = sorted.get_instance(last_transition).get(column);
-    std::string category = val.get_category();
-    part[category] = Dataframe::Ptr(
-        new View(sorted, last_transition, transition));
-    last_transition = transition;
+    int row = get_row(idx);
+    rows[col.codes[row]].push_back(row);
   }
+  part.clear();
+  part.resize(rows.size());
+  for (Code code = 0; code < rows.size(); ++code)
   {
-    const Value& val = sorted.get_instance(last_transition).get(column);
-    std::string category = val.get_category();
-    part[category] = Dataframe::Ptr(
-        new View(sorted, last_transition, sorted.get_nrecords()));
+    if (rows[code].empty()) continue;
+    part[code] = Dataframe::Ptr(
+        new View(get_root(), std::move(rows[code]), get_weights()));
   }
 }
 
@@ -319,36 +401,227 @@ void Dataframe::print_attr_info(std::ostream& os, int column) const
   {
     CategoryFrequency density;
     category_freq(column, density);
-    os << " (categoric): pdf: " << density2str(density);
+    const Dictionary& dictionary = get_root().get_column(column).dictionary;
+    os << " (categoric): pdf: " << density2str(density, dictionary);
+  }
+}
+
+namespace /* utils for internal usage */
+{
+
+const char table_magic[8] = "SELTABL";
+const std::uint32_t table_version = 2;
+
+struct TableHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t ncolumns;
+  std::uint32_t target;
+  std::uint32_t reserved;
+  std::uint64_t nrows;
+  /* Checksum of the files the table was converted from (0 if none). */
+  std::uint64_t source;
+};
+
+/* Offsets of the arrays of a table in columnar format. */
+struct TableLayout
+{
+  TableLayout(const std::vector<Attribute>& attributes, std::size_t nrows)
+  {
+    std::size_t offset = align(sizeof(TableHeader) + attributes.size(), 8);
+    indices = offset;
+    offset = align(offset + nrows*sizeof(int), 8);
+    for (const Attribute& attribute : attributes)
+    {
+      missing.push_back(offset);
+      offset = align(offset + nrows, 8);
+      values.push_back(offset);
+      std::size_t size = attribute.numeric? sizeof(double) : sizeof(Code);
+      offset = align(offset + nrows*size, 8);
+    }
+    strings = offset;
+  }
+
+  std::size_t indices;
+  std::vector<std::size_t> missing;
+  std::vector<std::size_t> values;
+  /* Offset of the names and categories, after all the arrays. */
+  std::size_t strings;
+};
+
+template <class T>
+T* array(MappedFile& file, std::size_t offset)
+{
+  return reinterpret_cast<T*>(file.data() + offset);
+}
+
+/* Creates a file with room for the header and arrays of a table. Its
+ * source is 0 until set with write_source, once the file is complete. */
+std::unique_ptr<MappedFile> create_columnar(const std::string& filename,
+    const std::vector<Attribute>& attributes, int target, std::size_t nrows,
+    const TableLayout& layout)
+{
+  check_little_endian();
+  if (nrows > std::numeric_limits<int>::max())
+  {
+    throw SelException(std::string("Too many rows for a table: ") +
+        std::to_string(nrows));
+  }
+  std::unique_ptr<MappedFile> file(new MappedFile(filename, layout.strings));
+  TableHeader header;
+  std::memcpy(header.magic, table_magic, sizeof(table_magic));
+  header.version = table_version;
+  header.ncolumns = attributes.size();
+  header.target = target;
+  header.reserved = 0;
+  header.nrows = nrows;
+  header.source = 0;
+  std::memcpy(file->data(), &header, sizeof(header));
+  for (int idx = 0; idx < attributes.size(); ++idx)
+  {
+    file->data()[sizeof(header) + idx] = attributes[idx].numeric;
+  }
+  return file;
+}
+
+/* Appends the names and categories of the columns to a columnar file. */
+void write_strings(const std::string& filename,
+    const std::vector<Attribute>& attributes,
+    const std::vector<Column>& columns)
+{
+  std::ofstream out(filename, std::ios::binary | std::ios::app);
+  for (int idx = 0; idx < attributes.size(); ++idx)
+  {
+    write_string(out, attributes[idx].name);
+    const Dictionary& dictionary = columns[idx].dictionary;
+    std::uint32_t ncategories = dictionary.size();
+    write(out, &ncategories, 1);
+    for (Code code = 0; code < ncategories; ++code)
+    {
+      write_string(out, dictionary.decode(code));
+    }
+  }
+  if (not out)
+  {
+    throw SelException(std::string("File ")+filename+" cannot be written");
+  }
+}
+
+/* Records the checksum of the source of a complete columnar file. */
+void write_source(const std::string& filename, std::uint64_t source)
+{
+  std::fstream out(filename, std::ios::binary | std::ios::in | std::ios::out);
+  out.seekp(offsetof(TableHeader, source));
+  write(out, &source, 1);
+  if (not out)
+  {
+    throw SelException(std::string("File ")+filename+" cannot be written");
   }
 }
 
+/* Checksum of the source of a table in columnar format, 0 if it is not a
+ * valid table of the current version. */
+std::uint64_t cached_source(const std::string& filename)
+{
+  TableHeader header;
+  std::ifstream in(filename, std::ios::binary);
+  if (not in.read(reinterpret_cast<char*>(&header), sizeof(header)) or
+      std::memcmp(header.magic, table_magic, sizeof(table_magic)) != 0 or
+      header.version != table_version) return 0;
+  return header.source;
+}
+
+std::uint64_t source_checksum(const std::string& csv, const std::string& meta)
+{
+  /* Never 0, which stands for tables without source. */
+  return (checksum(csv)*31 + checksum(meta)) | 1;
+}
+
+/* Whether filename is a table converted from csv and meta that is still up
+ * to date and can be mapped. */
+bool valid_cache(const std::string& filename, const std::string& csv,
+    const std::string& meta)
+{
+  if (not std::ifstream(filename) or
+      cached_source(filename) != source_checksum(csv, meta)) return false;
+  try
+  {
+    Table::map(filename);
+  }
+  catch (SelException&)
+  {
+    return false;
+  }
+  return true;
+}
+
+/* Name of a temporary file next to filename that no other writer, in this
+ * process or another one, uses at the same time. */
+std::string temporary_filename(const std::string& filename)
+{
+  static std::atomic<unsigned> counter(0);
+  return filename + ".tmp" + std::to_string(getpid()) + "." +
+    std::to_string(counter++);
+}
+
+} /* end anonymous namespace */
+
 ////////////////
 // Table methods
 ////////////////
 
-Table::Table(const std::string& csv, const std::string& meta)
+Table::Table(const std::string& csv, const std::string& meta, int threads)
+  : target_idx_(-1)
 {
+  std::string cache = cache_filename(csv);
+  if (std::ifstream(cache) and
+      cached_source(cache) == source_checksum(csv, meta))
+  {
+    try
+    {
+      *this = map(cache);
+      return;
+    }
+    catch (SelException&)
+    {
+      /* Damaged cache: read the data file, leaving the repair to
+       * update_cache. */
+    }
+  }
   read_metadata(meta);
-  read_csvdata(csv);
+  read_csvdata(csv, threads);
 }
 
-void Table::shuffle()
+void Table::shuffle(Rng& rng)
 {
-  for (int idx = 0; idx < instances_.size(); ++idx)
+  for (int idx = get_nrecords()-1; idx > 0; --idx)
   {
-    int jdx = std::rand() % instances_.size();
-    instances_[idx].swap(instances_[jdx]);
+    int jdx = rng.uniform(idx+1);
+    swap_rows(idx, jdx);
   }
 }
 
 void Table::sort_by_column(int column)
 {
-  auto cmp = [column](const Instance& a, const Instance& b)
+  std::vector<int> permutation(get_nrecords());
+  std::iota(permutation.begin(), permutation.end(), 0);
+  const Column& col = columns_[column];
+  if (attributes_[column].numeric)
+  {
+    auto cmp = [&col](int a, int b) { return col.numbers[a] < col.numbers[b]; };
+    std::sort(permutation.begin(), permutation.end(), cmp);
+  }
+  else
   {
-    return a.get(column) < b.get(column);
-  };
-  std::sort(instances_.begin(), instances_.end(), cmp);
+    auto cmp = [&col](int a, int b)
+    {
+      return col.dictionary.decode(col.codes[a]) <
+             col.dictionary.decode(col.codes[b]);
+    };
+    std::sort(permutation.begin(), permutation.end(), cmp);
+  }
+  permute_rows(permutation);
 }
 
 void Table::read_metadata(const std::string& meta)
@@ -388,90 +661,419 @@ void Table::read_metadata(const std::string& meta)
   target_idx_ = get_attribute_idx(target_name_);
 }
 
-void Table::read_csvdata(const std::string& csv)
+namespace /* utils for internal usage */
+{
+
+/* Smallest chunk of a data file parsed by its own thread. */
+const std::streamoff min_chunk = 1 << 22;
+
+void read_rows(CsvReader& reader, const std::vector<Attribute>& attributes,
+    std::vector<Column>& columns)
 {
-  CsvReader reader(csv);
-  CsvRow row;
+  CsvFields row;
+  std::string category;
+  columns.resize(attributes.size());
   while (reader.next_row(row))
   {
-    if (row.size() != attributes_.size())
+    if (row.size() != attributes.size())
     {
       throw SelException("Inconsistent number of columns");
     }
-    instances_.push_back(Instance());
-    instances_.back().init(this, instances_.size(), row);
+    for (int idx = 0; idx < row.size(); ++idx)
+    {
+      Column& column = columns[idx];
+      const CsvField& field = row[idx];
+      bool missing = field.is_missing();
+      column.missing.push_back(missing);
+      if (attributes[idx].numeric)
+      {
+        column.numbers.push_back(missing?
+            std::numeric_limits<double>::quiet_NaN() :
+            parse_number(field.data, field.data + field.size));
+      }
+      else
+      {
+        /* Reuses the storage of category, so known categories are not
+         * allocated again. */
+        category.assign(field.data, field.size);
+        column.codes.push_back(column.dictionary.encode(category));
+      }
+    }
+  }
+}
+
+/* Appends the rows of chunk to column, translating its codes. */
+void append(Column& column, const Column& chunk)
+{
+  column.numbers.append(chunk.numbers.begin(), chunk.numbers.end());
+  column.missing.append(chunk.missing.begin(), chunk.missing.end());
+  std::vector<Code> to_column;
+  for (Code code = 0; code < chunk.dictionary.size(); ++code)
+  {
+    to_column.push_back(column.dictionary.encode(chunk.dictionary.decode(code)));
+  }
+  for (Code code : chunk.codes) column.codes.push_back(to_column[code]);
+}
+
+} /* end anonymous namespace */
+
+void Table::read_csvdata(const std::string& csv, int threads)
+{
+  std::ifstream in(csv, std::ios::binary | std::ios::ate);
+  if (not in) throw SelException(std::string("Error opening ") + csv);
+  std::streamoff size = in.tellg();
+  if (threads <= 0) threads = std::thread::hardware_concurrency();
+  /* Each thread parses the rows that start in one chunk of the file. Codes
+   * are assigned by first occurrence, both within a chunk and when the
+   * chunks are concatenated in order, so they are the same as if the file
+   * was read sequentially. */
+  int nchunks = std::max<std::streamoff>(1,
+      std::min<std::streamoff>(threads, size / min_chunk));
+  std::vector<std::vector<Column>> chunks(nchunks);
+  parallel_for(nchunks, threads, [&](int chunk)
+  {
+    CsvReader reader(csv, size*chunk/nchunks, size*(chunk+1)/nchunks);
+    read_rows(reader, attributes_, chunks[chunk]);
+  });
+  columns_ = std::move(chunks[0]);
+  for (int chunk = 1; chunk < nchunks; ++chunk)
+  {
+    for (int idx = 0; idx < columns_.size(); ++idx)
+    {
+      append(columns_[idx], chunks[chunk][idx]);
+    }
+    chunks[chunk].clear();
+  }
+  std::vector<int> indices(columns_[0].missing.size());
+  std::iota(indices.begin(), indices.end(), 1);
+  indices_ = ColumnData<int>(std::move(indices));
+}
+
+std::string Table::cache_filename(const std::string& csv)
+{
+  std::size_t dot = csv.rfind('.');
+  std::size_t slash = csv.rfind('/');
+  if (dot == std::string::npos or
+      (slash != std::string::npos and dot < slash)) return csv + ".rfdata";
+  return csv.substr(0, dot) + ".rfdata";
+}
+
+bool Table::update_cache(const std::string& csv, const std::string& meta)
+{
+  std::string cache = cache_filename(csv);
+  if (valid_cache(cache, csv, meta)) return false;
+  /* Each writer converts into a file of its own, renamed over the cache
+   * once complete. */
+  std::string tmp = temporary_filename(cache);
+  try
+  {
+    convert(csv, meta, tmp);
+  }
+  catch (SelException&)
+  {
+    std::remove(tmp.c_str());
+    throw;
+  }
+  if (std::rename(tmp.c_str(), cache.c_str()) != 0)
+  {
+    std::remove(tmp.c_str());
+    throw SelException(std::string("File ")+cache+" cannot be written");
+  }
+  return true;
+}
+
+Table Table::map(const std::string& filename)
+{
+  check_little_endian();
+  auto file = std::make_shared<MappedFile>(filename);
+  BinaryReader reader(*file, filename, "table");
+  TableHeader header = *reader.read<TableHeader>(1);
+  if (std::memcmp(header.magic, table_magic, sizeof(table_magic)) != 0)
+  {
+    reader.corrupt();
+  }
+  if (header.version != table_version)
+  {
+    throw SelException(std::string("File ")+filename+" has version "+
+        std::to_string(header.version)+", expected "+
+        std::to_string(table_version));
+  }
+  if (header.nrows > std::numeric_limits<int>::max() or
+      header.target >= header.ncolumns) reader.corrupt();
+  std::size_t nrows = header.nrows;
+  Table ret;
+  ret.attributes_.resize(header.ncolumns);
+  ret.columns_.resize(header.ncolumns);
+  const std::uint8_t* numeric = reader.read<std::uint8_t>(header.ncolumns);
+  reader.align(8);
+  ret.indices_ = ColumnData<int>(reader.read<int>(nrows), nrows, file);
+  for (int idx = 0; idx < header.ncolumns; ++idx)
+  {
+    Column& column = ret.columns_[idx];
+    ret.attributes_[idx].numeric = numeric[idx];
+    reader.align(8);
+    column.missing = ColumnData<std::uint8_t>(
+        reader.read<std::uint8_t>(nrows), nrows, file);
+    reader.align(8);
+    if (numeric[idx])
+    {
+      column.numbers = ColumnData<double>(reader.read<double>(nrows), nrows,
+          file);
+    }
+    else
+    {
+      column.codes = ColumnData<Code>(reader.read<Code>(nrows), nrows, file);
+    }
+  }
+  reader.align(8);
+  for (int idx = 0; idx < header.ncolumns; ++idx)
+  {
+    ret.attributes_[idx].name = reader.read_string();
+    std::uint32_t ncategories = *reader.read<std::uint32_t>(1);
+    for (int code = 0; code < ncategories; ++code)
+    {
+      ret.columns_[idx].dictionary.encode(reader.read_string());
+    }
+  }
+  /* Codes are decoded as they are, so make sure that they cannot point out
+   * of the dictionaries. Only nominal columns are read, numbers stay on
+   * disk until they are used. */
+  for (int idx = 0; idx < header.ncolumns; ++idx)
+  {
+    if (numeric[idx]) continue;
+    const Column& column = ret.columns_[idx];
+    for (Code code : column.codes)
+    {
+      if (code >= column.dictionary.size()) reader.corrupt();
+    }
+  }
+  ret.target_idx_ = header.target;
+  ret.target_name_ = ret.attributes_[header.target].name;
+  return ret;
+}
+
+void Table::convert(const std::string& csv, const std::string& meta,
+    const std::string& filename)
+{
+  Table table;
+  table.read_metadata(meta);
+  const std::vector<Attribute>& attributes = table.attributes_;
+  CsvFields row;
+  std::size_t nrows = 0;
+  {
+    CsvReader reader(csv);
+    while (reader.next_row(row)) ++nrows;
+  }
+  TableLayout layout(attributes, nrows);
+  /* Only the dictionaries are kept in memory. */
+  std::vector<Column> columns(attributes.size());
+  {
+    std::unique_ptr<MappedFile> file = create_columnar(filename, attributes,
+        table.target_idx_, nrows, layout);
+    int* indices = array<int>(*file, layout.indices);
+    std::iota(indices, indices + nrows, 1);
+    CsvReader reader(csv);
+    std::string category;
+    std::size_t record = 0;
+    for (; reader.next_row(row); ++record)
+    {
+      if (record == nrows)
+      {
+        throw SelException(std::string("File ")+csv+" changed while reading");
+      }
+      if (row.size() != attributes.size())
+      {
+        throw SelException("Inconsistent number of columns");
+      }
+      for (int idx = 0; idx < row.size(); ++idx)
+      {
+        const CsvField& field = row[idx];
+        bool missing = field.is_missing();
+        array<std::uint8_t>(*file, layout.missing[idx])[record] = missing;
+        if (attributes[idx].numeric)
+        {
+          array<double>(*file, layout.values[idx])[record] = missing?
+            std::numeric_limits<double>::quiet_NaN() :
+            parse_number(field.data, field.data + field.size);
+        }
+        else
+        {
+          category.assign(field.data, field.size);
+          array<Code>(*file, layout.values[idx])[record] =
+            columns[idx].dictionary.encode(category);
+        }
+      }
+    }
+    if (record != nrows)
+    {
+      throw SelException(std::string("File ")+csv+" changed while reading");
+    }
+  }
+  write_strings(filename, attributes, columns);
+  write_source(filename, source_checksum(csv, meta));
+}
+
+void Table::save(const std::string& filename) const
+{
+  TableLayout layout(attributes_, get_nrecords());
+  {
+    std::unique_ptr<MappedFile> file = create_columnar(filename, attributes_,
+        target_idx_, get_nrecords(), layout);
+    std::copy(indices_.begin(), indices_.end(),
+        array<int>(*file, layout.indices));
+    for (int idx = 0; idx < columns_.size(); ++idx)
+    {
+      const Column& column = columns_[idx];
+      std::copy(column.missing.begin(), column.missing.end(),
+          array<std::uint8_t>(*file, layout.missing[idx]));
+      std::copy(column.numbers.begin(), column.numbers.end(),
+          array<double>(*file, layout.values[idx]));
+      std::copy(column.codes.begin(), column.codes.end(),
+          array<Code>(*file, layout.values[idx]));
+    }
+  }
+  write_strings(filename, attributes_, columns_);
+}
+
+void Table::swap_rows(int row1, int row2)
+{
+  int* indices = indices_.mutable_data();
+  std::swap(indices[row1], indices[row2]);
+  for (Column& column : columns_)
+  {
+    if (not column.numbers.empty())
+    {
+      double* numbers = column.numbers.mutable_data();
+      std::swap(numbers[row1], numbers[row2]);
+    }
+    if (not column.codes.empty())
+    {
+      Code* codes = column.codes.mutable_data();
+      std::swap(codes[row1], codes[row2]);
+    }
+    std::uint8_t* missing = column.missing.mutable_data();
+    std::swap(missing[row1], missing[row2]);
+  }
+}
+
+namespace /* utils for internal usage */
+{
+
+template <class T>
+void gather(ColumnData<T>& v, const std::vector<int>& permutation)
+{
+  if (v.empty()) return;
+  std::vector<T> permuted(v.size());
+  for (int idx = 0; idx < permutation.size(); ++idx)
+  {
+    permuted[idx] = v[permutation[idx]];
+  }
+  v = ColumnData<T>(std::move(permuted));
+}
+
+} /* end anonymous namespace */
+
+void Table::permute_rows(const std::vector<int>& permutation)
+{
+  gather(indices_, permutation);
+  for (Column& column : columns_)
+  {
+    gather(column.numbers, permutation);
+    gather(column.codes, permutation);
+    gather(column.missing, permutation);
   }
 }
 
 ///////////////
 // View methods
-//7////////////
+///////////////
 
-View::View(Dataframe& parent, int column, const std::string& exclude)
+View::View(const Table& root, std::vector<int>&& rows,
+    const Weights& weights)
+  : root_(root), rows_(std::move(rows)), weights_(weights)
+{
+}
+
+View::View(const Dataframe& parent, std::vector<double>&& weights)
   : root_(parent.get_root())
 {
+  const Weights& parent_weights = parent.get_weights();
   for (int idx = 0; idx < parent.get_nrecords(); ++idx)
   {
-    Instance& instance = parent[idx];
-    const std::string& cat = instance.get(column).get_category();
-    if (cat != exclude) instances_.push_back(&instance);
+    int row = parent.get_row(idx);
+    if (parent_weights) weights[row] *= (*parent_weights)[row];
+    if (weights[row] > 0) rows_.push_back(row);
   }
+  weights_ = std::make_shared<const std::vector<double>>(std::move(weights));
 }
 
-View::View(Dataframe& parent, int begin, int end, bool exclude)
-  : root_(parent.get_root())
+View::View(const Dataframe& parent, int column, Code exclude)
+  : root_(parent.get_root()), weights_(parent.get_weights())
+{
+  const ColumnData<Code>& codes = root_.get_column(column).codes;
+  for (int idx = 0; idx < parent.get_nrecords(); ++idx)
+  {
+    int row = parent.get_row(idx);
+    if (codes[row] != exclude) rows_.push_back(row);
+  }
+}
+
+View::View(const Dataframe& parent, int begin, int end, bool exclude)
+  : root_(parent.get_root()), weights_(parent.get_weights())
 {
   begin = clip(begin, 0, parent.get_nrecords());
   end = clip(end, 0, parent.get_nrecords());
   int slice_size = std::max(0, end-begin);
   if (exclude)
   {
-    instances_.resize(parent.get_nrecords() - slice_size);
+    rows_.resize(parent.get_nrecords() - slice_size);
     for (int idx = 0; idx < begin; ++idx)
     {
-      instances_[idx] = &parent[idx];
+      rows_[idx] = parent.get_row(idx);
     }
     for (int idx = end; idx < parent.get_nrecords(); ++idx)
     {
-      instances_[idx-end+begin] = &parent[idx];
+      rows_[idx-end+begin] = parent.get_row(idx);
     }
   }
   else
   {
-    instances_.resize(slice_size);
+    rows_.resize(slice_size);
     for (int idx = begin; idx < end; ++idx)
     {
-      instances_[idx-begin] = &parent[idx];
+      rows_[idx-begin] = parent.get_row(idx);
     }
   }
 }
 
-void View::shuffle()
+void View::shuffle(Rng& rng)
 {
-  for (int idx = 0; idx < instances_.size(); ++idx)
-  {
-    int jdx = std::rand() % instances_.size();
-    std::swap(instances_[idx], instances_[jdx]);
-  }
+  shuffle_rows(rows_.data(), rows_.data() + rows_.size(), rng);
 }
 
 void View::sort_by_column(int column)
 {
-  auto cmp = [column](const Instance* a, const Instance* b)
-  {
-    return a->get(column) < b->get(column);
-  };
-  std::sort(instances_.begin(), instances_.end(), cmp);
+  sort_rows(root_, column, rows_.data(), rows_.data() + rows_.size());
 }
 
 void View::filter(std::function<bool(const Instance&)> keep)
 {
-  std::vector<Instance*> instances;
-  for (auto instance : instances_)
+  std::vector<int> rows;
+  for (int idx = 0; idx < rows_.size(); ++idx)
   {
-    if (keep(*instance)) instances.push_back(instance);
+    if (keep(get_instance(idx))) rows.push_back(rows_[idx]);
   }
-  instances_.swap(instances);
+  rows_.swap(rows);
+}
+
+void Slice::shuffle(Rng& rng)
+{
+  shuffle_rows(begin_, end_, rng);
+}
+
+void Slice::sort_by_column(int column)
+{
+  sort_rows(root_, column, begin_, end_);
 }
 
 ///////////////
@@ -483,15 +1085,17 @@ std::ostream& operator<<(std::ostream& os, const Attribute& attr)
   return os << attr.name << '(' << (attr.numeric? "num" : "cat") << ')';
 }
 
-std::string density2str(const CategoryFrequency& density)
+std::string density2str(const CategoryFrequency& density,
+    const Dictionary& dictionary)
 {
   std::ostringstream oss;
   bool first = true;
   oss << '{';
-  for (const auto& entry : density)
+  for (Code code = 0; code < density.size(); ++code)
   {
+    if (density[code] == 0) continue;
     if (not first) oss << ',';
-    oss << entry.first << ':' << (entry.second*100) << '%';
+    oss << dictionary.decode(code) << ':' << (density[code]*100) << '%';
     first = false;
   }
   oss << '}';
@@ -4,19 +4,33 @@
 #include "common.h"
 #include "csv_reader.h"
 
+#include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
 
 namespace sel
 {
 
 struct Attribute;
+struct Column;
+class Dictionary;
 class Instance;
 class Dataframe;
 class Table;
 class View;
+class Slice;
 
-typedef std::map<std::string, double> CategoryFrequency;
+/**
+ * @brief Dense integer used to encode the categories of a nominal attribute.
+ */
+typedef std::uint32_t Code;
+
+/**
+ * @brief Number (or proportion) of occurrences of each category of a nominal
+ * attribute, indexed by Code.
+ */
+typedef std::vector<double> CategoryFrequency;
 
 struct Attribute
 {
@@ -24,53 +38,214 @@ struct Attribute
   bool numeric;
 };
 
-class Instance : public Stringifiable
+/**
+ * @brief Bidirectional mapping between the categories of a nominal attribute
+ * and dense integer codes (assigned in order of first appearance).
+ */
+class Dictionary
 {
-  friend Table; /* The only type capable of initializing Instances. */
+  public:
+
+    /**
+     * @return code of the given category, adding it to the dictionary if it
+     * was not known yet.
+     */
+    Code encode(const std::string& category);
 
+    /**
+     * @return code of the given category, or -1 if it is not known.
+     */
+    long find(const std::string& category) const;
+
+    const std::string& decode(Code code) const { return categories_[code]; }
+
+    int size() const { return categories_.size(); }
+
+  private:
+
+    std::vector<std::string> categories_;
+    std::unordered_map<std::string, Code> codes_;
+};
+
+/**
+ * @brief Contiguous values, either owned or mapped from a file (see
+ * Table::map).
+ *
+ * Mapped values are read-only: they are copied into memory the first time
+ * they are modified, so that only the columns that change need to fit in
+ * memory.
+ */
+template <class T>
+class ColumnData
+{
   public:
 
-    Instance(const Instance& other);
+    ColumnData() : data_(nullptr), size_(0) {}
 
-    Instance& operator=(const Instance& other);
+    explicit ColumnData(std::vector<T>&& values) :
+      values_(std::move(values)), data_(values_.data()), size_(values_.size())
+    {
+    }
 
-    int get_index() const { return idx_; }
+    /**
+     * @brief Mapped values, kept valid by storage.
+     */
+    ColumnData(const T* data, std::size_t size,
+        const std::shared_ptr<const void>& storage) :
+      data_(data), size_(size), storage_(storage)
+    {
+    }
 
-    const Value& get(int idx) const { return *values_.at(idx); }
+    ColumnData(const ColumnData& other) :
+      values_(other.values_), size_(other.size_), storage_(other.storage_)
+    {
+      data_ = storage_? other.data_ : values_.data();
+    }
 
-    const Value& get(const std::string& attr) const;
+    /**
+     * @brief Takes the values of other, which is left empty.
+     */
+    ColumnData(ColumnData&& other) :
+      values_(std::move(other.values_)), data_(other.data_),
+      size_(other.size_), storage_(std::move(other.storage_))
+    {
+      other.reset();
+    }
 
-    const Value& get(const Attribute& attr) const;
+    ColumnData& operator=(const ColumnData& other)
+    {
+      values_ = other.values_;
+      storage_ = other.storage_;
+      data_ = storage_? other.data_ : values_.data();
+      size_ = other.size_;
+      return *this;
+    }
+
+    ColumnData& operator=(ColumnData&& other)
+    {
+      if (this == &other) return *this;
+      values_ = std::move(other.values_);
+      storage_ = std::move(other.storage_);
+      data_ = other.data_;
+      size_ = other.size_;
+      other.reset();
+      return *this;
+    }
 
-    void set(int idx, Value::Ptr&& value);
+    const T& operator[](std::size_t idx) const { return data_[idx]; }
 
-    void set(const std::string& attr, Value::Ptr&& value);
+    std::size_t size() const { return size_; }
 
-    void set(const Attribute& attr, Value::Ptr&& value);
+    bool empty() const { return size_ == 0; }
 
-    virtual std::string to_str() const override;
+    const T* begin() const { return data_; }
 
-  private:
+    const T* end() const { return data_ + size_; }
 
-    Instance() {}
+    bool is_mapped() const { return bool(storage_); }
 
-    /** 
-     * @brief Instances can be only initialized by Table members when loading
-     * the data set from a file.
-     * 
-     * @param dataframe Parent data frame
-     * @param idx Index of the instance
-     * @param row Raw data
+    /**
+     * @return Writable values (copied into memory if they were mapped).
      */
-    void init(const Dataframe* dataframe, int idx, const CsvRow& row);
+    T* mutable_data()
+    {
+      own();
+      return values_.data();
+    }
+
+    void push_back(const T& value)
+    {
+      own();
+      values_.push_back(value);
+      data_ = values_.data();
+      size_ = values_.size();
+    }
 
-    void swap(Instance& other);
+    void append(const T* first, const T* last)
+    {
+      own();
+      values_.insert(values_.end(), first, last);
+      data_ = values_.data();
+      size_ = values_.size();
+    }
 
-    void copy(const Instance& other);
+  private:
+
+    void reset()
+    {
+      values_.clear();
+      data_ = nullptr;
+      size_ = 0;
+      storage_.reset();
+    }
 
-    const Dataframe* dataframe_;
-    int idx_;
-    std::vector<Value::Ptr> values_;
+    void own()
+    {
+      if (not storage_) return;
+      values_.assign(data_, data_ + size_);
+      data_ = values_.data();
+      storage_.reset();
+    }
+
+    std::vector<T> values_;
+    const T* data_;
+    std::size_t size_;
+    /* Owner of data_ when mapped. */
+    std::shared_ptr<const void> storage_;
+};
+
+/**
+ * @brief Contiguous storage of the values of a single attribute.
+ *
+ * Only one of numbers (Real attributes) or codes (Nominal attributes) is
+ * populated. Missing numbers are stored as NaN, whereas missing categories
+ * are encoded like any other category ("?"). In both cases, the missing
+ * flag is set.
+ */
+struct Column
+{
+  ColumnData<double> numbers;
+  ColumnData<Code> codes;
+  ColumnData<std::uint8_t> missing;
+  Dictionary dictionary;
+};
+
+/**
+ * @brief Lightweight handle to a row of a Table.
+ *
+ * Instances do not own any data, they just refer to a row of the columns
+ * stored by the root Table.
+ */
+class Instance : public Stringifiable
+{
+  friend Dataframe; /* The only type capable of initializing Instances. */
+
+  public:
+
+    int get_index() const;
+
+    bool is_missing(int idx) const;
+
+    double get_number(int idx) const;
+
+    Code get_code(int idx) const;
+
+    const std::string& get_category(int idx) const;
+
+    void set(int idx, const Value& value);
+
+    void set(const std::string& attr, const Value& value);
+
+    void set(const Attribute& attr, const Value& value);
+
+    virtual std::string to_str() const override;
+
+  private:
+
+    Instance(Table* table, int row) : table_(table), row_(row) {}
+
+    Table* table_;
+    int row_;
 
 };
 
@@ -79,7 +254,11 @@ class Dataframe : public Stringifiable
   public:
 
     typedef std::unique_ptr<Dataframe> Ptr;
-    typedef std::map<std::string, Ptr> Partition;
+    /* Views indexed by Code (null for categories without records). */
+    typedef std::vector<Ptr> Partition;
+
+    /* Weight of each row of the root Table. */
+    typedef std::shared_ptr<const std::vector<double>> Weights;
 
     virtual int get_nrecords() const = 0;
 
@@ -102,9 +281,33 @@ class Dataframe : public Stringifiable
 
     virtual const Attribute& get_attribute(int idx) const = 0;
 
-    virtual Instance& operator[](int idx) = 0;
+    /**
+     * @return index (in the root Table) of the idx-th record of this
+     * dataframe.
+     */
+    virtual int get_row(int idx) const = 0;
+
+    /**
+     * @return weights of the rows of the root table, or null if all the
+     * records of this dataframe weigh 1.
+     */
+    virtual const Weights& get_weights() const;
+
+    /**
+     * @return weight of the idx-th record (e.g. its multiplicity in a
+     * bootstrap sample).
+     */
+    double get_weight(int idx) const
+    {
+      const Weights& weights = get_weights();
+      return weights? (*weights)[get_row(idx)] : 1;
+    }
+
+    double get_total_weight() const;
+
+    Instance operator[](int idx);
 
-    virtual const Instance& get_instance(int idx) const = 0;
+    const Instance get_instance(int idx) const;
 
     virtual const Table& get_root() const = 0;
 
@@ -165,7 +368,7 @@ class Dataframe : public Stringifiable
 
     double min(const Attribute& column) const { return min(column.name); }
 
-    virtual void shuffle() = 0;
+    virtual void shuffle(Rng& rng) = 0;
 
     virtual void sort_by_column(int column) = 0;
 
@@ -197,11 +400,72 @@ class Dataframe : public Stringifiable
 
 class Table : public Dataframe
 {
+  friend Instance;
+
   public:
 
-    Table(const std::string& csv, const std::string& meta);
+    /** 
+     * @param csv Data file.
+     * @param meta Metadata file (number of columns, attributes and target).
+     * @param threads Number of threads that parse chunks of the data file
+     * (<= 0 means one per hardware thread).
+     *
+     * If the cache of the data file (see update_cache) is up to date, the
+     * table is mapped from it instead of parsing the data file. A damaged
+     * cache is left as it is (update_cache rewrites it) and the data file
+     * parsed.
+     */
+    Table(const std::string& csv, const std::string& meta, int threads=1);
 
-    virtual int get_nrecords() const override { return instances_.size(); }
+    /** 
+     * @return Name of the cache of a data file: the same name, with extension
+     * .rfdata.
+     */
+    static std::string cache_filename(const std::string& csv);
+
+    /** 
+     * @brief Converts a data file into its cache (a table in columnar format
+     * that records a checksum of the data and metadata files), unless the
+     * cache is already up to date and can be mapped.
+     *
+     * The cache is written to a temporary file of its own and renamed once
+     * complete, so concurrent writers and readers never see a partial one.
+     *
+     * @return Whether the cache was written.
+     */
+    static bool update_cache(const std::string& csv, const std::string& meta);
+
+    /** 
+     * @brief Maps a table saved in columnar format into memory (throws
+     * SelException if the file is not a valid table).
+     *
+     * Columns are read from the file as they are accessed, and can be
+     * evicted from memory again, so the table may be larger than the
+     * available memory as long as it is not modified (shuffling or imputing
+     * it copies the affected columns into memory).
+     */
+    static Table map(const std::string& filename);
+
+    /** 
+     * @brief Converts a data file into columnar format, one column at a
+     * time, without loading it into memory (the data file is read twice).
+     */
+    static void convert(const std::string& csv, const std::string& meta,
+        const std::string& filename);
+
+    /** 
+     * @brief Saves the table in columnar format.
+     *
+     * The format is little-endian: a header ("SELTABL" magic, version, number
+     * of rows and columns, target, checksum of the source files of a cache),
+     * the type of each column, the indices of
+     * the records and then, for each column, its missing flags (one byte
+     * each) and its numbers (double) or codes (uint32), every array 8-byte
+     * aligned. It ends with the name and categories of each column.
+     */
+    void save(const std::string& filename) const;
+
+    virtual int get_nrecords() const override { return indices_.size(); }
 
     virtual int get_nattributes() const override { return attributes_.size(); }
     
@@ -214,16 +478,13 @@ class Table : public Dataframe
       return attributes_[idx];
     }
 
-    virtual Instance& operator[](int idx) { return instances_[idx]; }
-
-    virtual const Instance& get_instance(int idx) const
-    {
-      return instances_[idx];
-    }
+    virtual int get_row(int idx) const override { return idx; }
 
     virtual const Table& get_root() const override { return *this; }
 
-    virtual void shuffle() override;
+    const Column& get_column(int idx) const { return columns_[idx]; }
+
+    virtual void shuffle(Rng& rng) override;
 
     virtual void sort_by_column(int column) override;
 
@@ -232,14 +493,19 @@ class Table : public Dataframe
 
   private:
 
+    Table() : target_idx_(-1) {}
+
     void read_metadata(const std::string& meta);
 
-    void read_csvdata(const std::string& csv);
+    void read_csvdata(const std::string& csv, int threads);
 
-    void copy(const Table& other);
+    void swap_rows(int row1, int row2);
+
+    void permute_rows(const std::vector<int>& permutation);
 
     std::vector<Attribute> attributes_;
-    std::vector<Instance> instances_;
+    std::vector<Column> columns_;
+    ColumnData<int> indices_;
     std::string target_name_;
     int target_idx_;
 };
@@ -248,12 +514,25 @@ class View : public Dataframe
 {
   public:
 
-    View(Dataframe& parent, int column, const std::string& exclude);
+    View(const Table& root, std::vector<int>&& rows,
+        const Weights& weights=Weights());
+
+    /**
+     * @brief Weighted view with the records of parent whose weight is
+     * positive.
+     *
+     * @param weights Weight of each row of the root table (e.g. the number of
+     * times each row has been drawn in a bootstrap sample). They are
+     * multiplied by the weights of parent, if any.
+     */
+    View(const Dataframe& parent, std::vector<double>&& weights);
 
-    View(Dataframe& parent, int begin=0,
+    View(const Dataframe& parent, int column, Code exclude);
+
+    View(const Dataframe& parent, int begin=0,
         int end=std::numeric_limits<int>::max(), bool exclude=false);
 
-    virtual int get_nrecords() const override { return instances_.size(); }
+    virtual int get_nrecords() const override { return rows_.size(); }
 
     virtual int get_nattributes() const override
     {
@@ -275,36 +554,94 @@ class View : public Dataframe
       return root_.get_attribute(idx);
     }
 
-    virtual Instance& operator[](int idx)
+    virtual int get_row(int idx) const override { return rows_[idx]; }
+
+    virtual const Weights& get_weights() const override { return weights_; }
+
+    virtual const Table& get_root() const override { return root_; }
+
+    virtual void shuffle(Rng& rng) override;
+
+    virtual void sort_by_column(int column) override;
+
+    void filter(std::function<bool(const Instance&)> keep);
+
+    using Dataframe::sort_by_column;
+
+  private:
+
+    const Table& root_;
+    std::vector<int> rows_;
+    Weights weights_;
+
+};
+
+/**
+ * @brief Records of a range of an array of rows (of the root table), which
+ * is not owned.
+ *
+ * Trees are grown on slices of a single array: the rows of a node are
+ * reordered in place so that those of each child form a range.
+ */
+class Slice : public Dataframe
+{
+  public:
+
+    Slice(const Table& root, int* begin, int* end,
+        const Weights& weights=Weights()) :
+      root_(root), begin_(begin), end_(end), weights_(weights) {}
+
+    virtual int get_nrecords() const override { return end_ - begin_; }
+
+    virtual int get_nattributes() const override
+    {
+      return root_.get_nattributes();
+    }
+
+    virtual const std::string& get_target_name() const
+    {
+      return root_.get_target_name();
+    }
+
+    virtual int get_target_idx() const
     {
-      return *instances_[idx];
+      return root_.get_target_idx();
     }
 
-    virtual const Instance& get_instance(int idx) const
+    virtual const Attribute& get_attribute(int idx) const override
     {
-      return *instances_[idx];
+      return root_.get_attribute(idx);
     }
 
+    virtual int get_row(int idx) const override { return begin_[idx]; }
+
+    virtual const Weights& get_weights() const override { return weights_; }
+
     virtual const Table& get_root() const override { return root_; }
 
-    virtual void shuffle() override;
+    int* begin() const { return begin_; }
 
-    virtual void sort_by_column(int column) override;
+    int* end() const { return end_; }
 
-    void filter(std::function<bool(const Instance&)> keep);
+    virtual void shuffle(Rng& rng) override;
+
+    virtual void sort_by_column(int column) override;
 
     using Dataframe::sort_by_column;
 
   private:
 
     const Table& root_;
-    std::vector<Instance*> instances_;
+    int* begin_;
+    int* end_;
+    Weights weights_;
 
 };
 
 std::ostream& operator<<(std::ostream& os, const Attribute& attr);
 
-std::string density2str(const CategoryFrequency& density);
+std::string density2str(const CategoryFrequency& density,
+    const Dictionary& dictionary);
 
 } /* end namespace rise */
 
@@ -1,14 +1,85 @@
+#include "csv_reader.h"
 #include "dataframe.h"
+#include <cstdio>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 
 #ifndef DATA_PATH
 #define DATA_PATH "../Data/"
 #endif
 
+namespace
+{
+
+/* Whether a and b hold the same values, record by record. */
+bool same_records(const sel::Dataframe& a, const sel::Dataframe& b)
+{
+  if (a.get_nrecords() != b.get_nrecords() or
+      a.get_nattributes() != b.get_nattributes()) return false;
+  for (int row = 0; row < a.get_nrecords(); ++row)
+  {
+    const sel::Instance x = a.get_instance(row), y = b.get_instance(row);
+    for (int idx = 0; idx < a.get_nattributes(); ++idx)
+    {
+      if (x.is_missing(idx) != y.is_missing(idx)) return false;
+      if (x.is_missing(idx)) continue;
+      if (a.get_attribute(idx).numeric)
+      {
+        if (x.get_number(idx) != y.get_number(idx)) return false;
+      }
+      else if (x.get_category(idx) != y.get_category(idx)) return false;
+    }
+  }
+  return true;
+}
+
+/* Whether the numbers of a table read from csv (without shuffling it) are
+ * those given by strtod. */
+bool same_numbers(const sel::Table& table, const std::string& csv)
+{
+  sel::CsvReader reader(csv);
+  sel::CsvRow row;
+  for (int record = 0; reader.next_row(row); ++record)
+  {
+    const sel::Instance instance = table.get_instance(record);
+    for (int idx = 0; idx < row.size(); ++idx)
+    {
+      if (not table.get_attribute(idx).numeric or instance.is_missing(idx))
+      {
+        continue;
+      }
+      if (instance.get_number(idx) != std::strtod(row[idx].c_str(), nullptr))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/* Copies the records of csv into filename, repeated until it has at least
+ * size bytes. */
+void repeat_records(const std::string& csv, const std::string& filename,
+    long size)
+{
+  std::ifstream in(csv);
+  std::string data((std::istreambuf_iterator<char>(in)),
+      std::istreambuf_iterator<char>());
+  if (not data.empty() and data.back() != '\n') data += '\n';
+  std::ofstream out(filename);
+  for (long written = 0; written < size; written += data.size()) out << data;
+}
+
+const char* yes_no(bool value)
+{
+  return value? "yes" : "no";
+}
+
+}
+
 int main(int argc, char* argv[])
 {
-  srand(42);
   if (argc != 2)
   {
     std::cerr << "Usage: " << argv[0] << " datasetname\n";
@@ -19,10 +90,9 @@ int main(int argc, char* argv[])
     std::string datafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".data";
     std::string metafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".meta";
 
-    std::srand(42);
-
     sel::Table table(datafile, metafile);
-    table.shuffle();
+    sel::Rng rng(42);
+    table.shuffle(rng);
     std::cout << table << std::endl;
 
     //sel::View v1(table, 130);
@@ -39,10 +109,60 @@ int main(int argc, char* argv[])
       //std::cout << "Partition " << p.first << ':' << std::endl;
       //std::cout << *p.second << std::endl;
     //}
+
+    bool ok = true;
+    /* The files below are written to the working directory (a copy of the
+     * data file, so that it has no cache yet) and removed at the end. */
+    std::string copy = std::string(argv[1]) + "_copy.data";
+    std::string cache = sel::Table::cache_filename(copy);
+    std::string saved = std::string(argv[1]) + "_saved.rfdata";
+    std::remove(cache.c_str());
+
+    /* Large enough to be parsed in several chunks, whose rows start at
+     * arbitrary offsets. */
+    repeat_records(datafile, copy, 1L << 24);
+    sel::Table sequential(copy, metafile, 1);
+    sel::Table chunked(copy, metafile, 4);
+    bool same = same_numbers(sequential, copy);
+    std::cout << "Numbers parsed as by strtod: " << yes_no(same) << '\n';
+    ok = ok and same;
+    same = same_records(sequential, chunked);
+    std::cout << "Parsing in chunks matches a sequential read ("
+      << sequential.get_nrecords() << " records): " << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* The shuffled table is saved in columnar format and mapped back. */
+    table.save(saved);
+    sel::Table mapped = sel::Table::map(saved);
+    same = same_records(table, mapped);
+    std::cout << "Saved and mapped table matches: " << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* The cache is only rewritten when the data file changes. */
+    bool written = sel::Table::update_cache(copy, metafile);
+    std::cout << "Cache written: " << yes_no(written) << '\n';
+    written = sel::Table::update_cache(copy, metafile);
+    std::cout << "Cache written again while up to date: " << yes_no(written)
+      << '\n';
+    ok = ok and not written;
+    sel::Table cached(copy, metafile);
+    same = same_records(sequential, cached);
+    std::cout << "Table loaded from the cache matches: " << yes_no(same)
+      << '\n';
+    ok = ok and same;
+    repeat_records(datafile, copy, 1);
+    written = sel::Table::update_cache(copy, metafile);
+    std::cout << "Cache written after the data file changed: "
+      << yes_no(written) << '\n';
+    ok = ok and written;
+
+    std::remove(copy.c_str());
+    std::remove(cache.c_str());
+    std::remove(saved.c_str());
+    if (not ok) return 1;
   }
   catch (sel::SelException& ex)
   {
     std::cerr << ex.what() << '\n';
   }
 }
-
@@ -0,0 +1,645 @@
+#include "flat_forest.h"
+#include "binary_file.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <set>
+
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+#include <immintrin.h>
+#define SEL_AVX2_KERNEL
+#endif
+
+namespace sel
+{
+
+namespace /* utils for internal usage */
+{
+
+const char magic[8] = "SELFRST";
+const std::uint32_t version = 2;
+
+struct Header
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t ntrees;
+  std::uint32_t nnodes;
+  std::uint32_t nattributes;
+  std::uint32_t nclasses;
+  std::uint32_t nmasks;
+};
+
+void collect_guesses(const DecisionTree& tree, std::set<std::string>& guesses)
+{
+  if (tree.get_stump())
+  {
+    collect_guesses(tree.get_left(), guesses);
+    collect_guesses(tree.get_right(), guesses);
+  }
+  else guesses.insert(tree.get_guess());
+}
+
+} /* end anonymous namespace */
+
+FlatForest::FlatForest(const std::vector<DecisionTree::Ptr>& trees)
+{
+  std::set<std::string> guesses;
+  for (const auto& tree : trees) collect_guesses(*tree, guesses);
+  for (const std::string& guess : guesses) classes_.encode(guess);
+
+  auto storage = std::make_shared<
+    std::pair<std::vector<Node>, std::vector<std::uint64_t>>>();
+  std::vector<Node>& nodes = storage->first;
+  std::vector<std::uint64_t>& masks = storage->second;
+  std::deque<std::pair<const DecisionTree*, int>> queue;
+  /* Categorical nodes, whose bitsets are made once the dictionaries hold
+   * all the categories. */
+  std::vector<std::pair<int, const CategoricalDecisionStump*>> categorical;
+  for (const auto& tree : trees)
+  {
+    roots_.push_back(nodes.size());
+    numeric_trees_.push_back(1);
+    nodes.push_back(Node());
+    queue.emplace_back(tree.get(), roots_.back());
+    while (not queue.empty())
+    {
+      const DecisionTree* subtree = queue.front().first;
+      int index = queue.front().second;
+      Node& node = nodes[index];
+      queue.pop_front();
+      const DecisionStump* stump = subtree->get_stump();
+      if (not stump)
+      {
+        node.feature = -1;
+        node.next = classes_.find(subtree->get_guess());
+        node.value = 0;
+        continue;
+      }
+      int feature = stump->get_split();
+      node.feature = feature;
+      node.next = nodes.size();
+      if (numeric_.size() <= feature)
+      {
+        numeric_.resize(feature + 1, 0);
+        dictionaries_.resize(feature + 1);
+        names_.resize(feature + 1);
+      }
+      names_[feature] = stump->get_attribute().name;
+      if (stump->get_attribute().numeric)
+      {
+        numeric_[feature] = 1;
+        node.value = static_cast<const NumericDecisionStump*>(stump)->
+          get_threshold();
+      }
+      else
+      {
+        numeric_trees_.back() = 0;
+        auto categorical_stump =
+          static_cast<const CategoricalDecisionStump*>(stump);
+        for (const std::string& category : categorical_stump->get_to_left())
+        {
+          dictionaries_[feature].encode(category);
+        }
+        categorical.emplace_back(index, categorical_stump);
+        node.value = 0;
+      }
+      /* node is invalidated by the insertions */
+      queue.emplace_back(&subtree->get_left(), nodes.size());
+      nodes.push_back(Node());
+      queue.emplace_back(&subtree->get_right(), nodes.size());
+      nodes.push_back(Node());
+    }
+  }
+  for (const auto& pending : categorical)
+  {
+    Node& node = nodes[pending.first];
+    long offset = masks.size();
+    node.value = offset;
+    masks.resize(offset + mask_words(node.feature), 0);
+    for (const std::string& category : pending.second->get_to_left())
+    {
+      long code = dictionaries_[node.feature].find(category);
+      masks[offset + code/64] |= std::uint64_t(1) << code%64;
+    }
+  }
+  nodes_ = nodes.data();
+  nnodes_ = nodes.size();
+  masks_ = masks.data();
+  nmasks_ = masks.size();
+  storage_ = storage;
+  make_tiles();
+}
+
+FlatForest::FlatForest(const FlatForest& forest, const std::vector<int>& trees) :
+  FlatForest(forest)
+{
+  roots_.clear();
+  numeric_trees_.clear();
+  for (int tree : trees)
+  {
+    roots_.push_back(forest.roots_[tree]);
+    numeric_trees_.push_back(forest.numeric_trees_[tree]);
+  }
+  make_tiles();
+}
+
+void FlatForest::set_tile_bytes(long bytes)
+{
+  tile_bytes_ = bytes;
+  make_tiles();
+}
+
+void FlatForest::make_tiles()
+{
+  tiles_.clear();
+  for (int tree = 0; tree < get_ntrees(); ++tree)
+  {
+    /* A new tile starts once the trees of the current one fill
+     * tile_bytes_. */
+    if (tiles_.empty() or
+        (roots_[tree] - roots_[tiles_.back()])*(long)sizeof(Node) >=
+        tile_bytes_)
+    {
+      tiles_.push_back(tree);
+    }
+  }
+  tiles_.push_back(get_ntrees());
+}
+
+bool FlatForest::is_binary(const std::string& filename)
+{
+  char buffer[sizeof(magic)] = {0};
+  std::ifstream in(filename, std::ios::binary);
+  in.read(buffer, sizeof(buffer));
+  return in and std::memcmp(buffer, magic, sizeof(magic)) == 0;
+}
+
+FlatForest::Ptr FlatForest::load(const std::string& filename)
+{
+  check_little_endian();
+  auto mapping = std::make_shared<MappedFile>(filename);
+  BinaryReader reader(*mapping, filename, "model");
+  Header header = *reader.read<Header>(1);
+  if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) reader.corrupt();
+  if (header.version != version)
+  {
+    throw SelException(std::string("File ")+filename+" has version "+
+        std::to_string(header.version)+", expected "+std::to_string(version));
+  }
+  Ptr ret(new FlatForest);
+  const std::int32_t* roots = reader.read<std::int32_t>(header.ntrees);
+  ret->roots_.assign(roots, roots + header.ntrees);
+  reader.align(alignof(Node));
+  ret->nodes_ = reader.read<Node>(header.nnodes);
+  ret->nnodes_ = header.nnodes;
+  ret->masks_ = reader.read<std::uint64_t>(header.nmasks);
+  ret->nmasks_ = header.nmasks;
+  ret->storage_ = mapping;
+  const std::uint8_t* numeric = reader.read<std::uint8_t>(header.nattributes);
+  ret->numeric_.assign(numeric, numeric + header.nattributes);
+  for (int idx = 0; idx < header.nclasses; ++idx)
+  {
+    ret->classes_.encode(reader.read_string());
+  }
+  ret->dictionaries_.resize(header.nattributes);
+  ret->names_.resize(header.nattributes);
+  for (int feature = 0; feature < header.nattributes; ++feature)
+  {
+    ret->names_[feature] = reader.read_string();
+    std::uint32_t ncategories = *reader.read<std::uint32_t>(1);
+    for (int idx = 0; idx < ncategories; ++idx)
+    {
+      ret->dictionaries_[feature].encode(reader.read_string());
+    }
+  }
+  /* Nodes are used as they are, so make sure that they cannot point out of
+   * the arrays. */
+  for (int tree = 0; tree < ret->get_ntrees(); ++tree)
+  {
+    int root = ret->roots_[tree];
+    if (root < 0 or root >= ret->nnodes_) reader.corrupt();
+    if (tree > 0 and root <= ret->roots_[tree-1]) reader.corrupt();
+  }
+  for (int idx = 0; idx < ret->nnodes_; ++idx)
+  {
+    const Node& node = ret->nodes_[idx];
+    if (node.feature < 0)
+    {
+      if (node.feature != -1 or node.next < 0 or
+          node.next >= ret->classes_.size()) reader.corrupt();
+    }
+    else if (node.feature >= header.nattributes or node.next <= idx or
+        node.next + 1 >= ret->nnodes_) reader.corrupt();
+    else if (not ret->numeric_[node.feature] and not (node.value >= 0 and
+          node.value + ret->mask_words(node.feature) <= ret->nmasks_ and
+          node.value == (long)node.value)) reader.corrupt();
+  }
+  /* The nodes of each tree follow its root. */
+  for (int tree = 0; tree < ret->get_ntrees(); ++tree)
+  {
+    int end = tree + 1 < ret->get_ntrees()? ret->roots_[tree+1] : ret->nnodes_;
+    ret->numeric_trees_.push_back(1);
+    for (int idx = ret->roots_[tree]; idx < end; ++idx)
+    {
+      int feature = ret->nodes_[idx].feature;
+      if (feature >= 0 and not ret->numeric_[feature])
+      {
+        ret->numeric_trees_.back() = 0;
+      }
+    }
+  }
+  ret->make_tiles();
+  return ret;
+}
+
+void FlatForest::save(const std::string& filename) const
+{
+  check_little_endian();
+  std::ofstream out(filename, std::ios::binary);
+  if (not out)
+  {
+    throw SelException(std::string("File ")+filename+" cannot be written");
+  }
+  Header header;
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.ntrees = roots_.size();
+  header.nnodes = nnodes_;
+  header.nattributes = numeric_.size();
+  header.nclasses = classes_.size();
+  header.nmasks = nmasks_;
+  write(out, &header, 1);
+  std::vector<std::int32_t> roots(roots_.begin(), roots_.end());
+  write(out, roots.data(), roots.size());
+  std::size_t offset = sizeof(header) + roots.size()*sizeof(std::int32_t);
+  std::vector<char> padding((alignof(Node) - offset%alignof(Node))%alignof(Node));
+  write(out, padding.data(), padding.size());
+  write(out, nodes_, nnodes_);
+  write(out, masks_, nmasks_);
+  std::vector<std::uint8_t> numeric(numeric_.begin(), numeric_.end());
+  write(out, numeric.data(), numeric.size());
+  for (Code code = 0; code < classes_.size(); ++code)
+  {
+    write_string(out, classes_.decode(code));
+  }
+  for (int feature = 0; feature < numeric_.size(); ++feature)
+  {
+    write_string(out, names_[feature]);
+    std::uint32_t ncategories = dictionaries_[feature].size();
+    write(out, &ncategories, 1);
+    for (Code code = 0; code < ncategories; ++code)
+    {
+      write_string(out, dictionaries_[feature].decode(code));
+    }
+  }
+  if (not out)
+  {
+    throw SelException(std::string("File ")+filename+" cannot be written");
+  }
+}
+
+DecisionTree::Ptr FlatForest::get_tree(int tree) const
+{
+  return DecisionTree::Ptr(get_subtree(roots_[tree]));
+}
+
+DecisionTree* FlatForest::get_subtree(int index) const
+{
+  const Node& node = nodes_[index];
+  if (node.feature < 0) return new DecisionTree(classes_.decode(node.next));
+  DecisionStump::Ptr stump;
+  if (numeric_[node.feature])
+  {
+    stump.reset(new NumericDecisionStump(names_[node.feature], node.feature,
+          node.value));
+  }
+  else
+  {
+    const Dictionary& dictionary = dictionaries_[node.feature];
+    std::vector<std::string> to_left;
+    for (Code code = 0; code < dictionary.size(); ++code)
+    {
+      if (in_mask(node, code)) to_left.push_back(dictionary.decode(code));
+    }
+    stump.reset(new CategoricalDecisionStump(names_[node.feature],
+          node.feature, to_left));
+  }
+  DecisionTree::Ptr left(get_subtree(node.next));
+  DecisionTree::Ptr right(get_subtree(node.next + 1));
+  return new DecisionTree(stump.release(), left.release(), right.release());
+}
+
+const Dictionary& FlatForest::get_dictionary(int column) const
+{
+  static const Dictionary empty;
+  if (column < dictionaries_.size()) return dictionaries_[column];
+  return empty;
+}
+
+Code FlatForest::classify(int tree, const Instance& instance) const
+{
+  const Node* node = &nodes_[roots_[tree]];
+  while (node->feature >= 0)
+  {
+    bool left;
+    if (numeric_[node->feature])
+    {
+      left = instance.get_number(node->feature) < node->value;
+    }
+    else
+    {
+      left = in_mask(*node, dictionaries_[node->feature].find(
+            instance.get_category(node->feature)));
+    }
+    node = &nodes_[left? node->next : node->next + 1];
+  }
+  return node->next;
+}
+
+Code FlatForest::classify(const Instance& instance,
+    std::vector<int>& votes) const
+{
+  votes.assign(classes_.size(), 0);
+  for (int tree = 0; tree < get_ntrees(); ++tree)
+  {
+    ++votes[classify(tree, instance)];
+  }
+  return vote(votes.data(), votes.size());
+}
+
+void FlatForest::classify(const Dataframe& data, std::vector<Code>& guesses,
+    int* votes) const
+{
+  const Table& root = data.get_root();
+  std::vector<char> tested(numeric_.size(), 0);
+  for (int idx = 0; idx < nnodes_; ++idx)
+  {
+    if (nodes_[idx].feature >= 0) tested[nodes_[idx].feature] = 1;
+  }
+  /* Code, in the dictionaries of the forest, of the categories of data (-1
+   * for those unknown to the forest). */
+  std::vector<std::vector<long>> to_forest(numeric_.size());
+  std::vector<const Column*> columns(numeric_.size());
+  for (int feature = 0; feature < numeric_.size(); ++feature)
+  {
+    if (not tested[feature]) continue;
+    check_column(data, feature, numeric_[feature]);
+    columns[feature] = &root.get_column(feature);
+    if (numeric_[feature]) continue;
+    const Dictionary& dictionary = columns[feature]->dictionary;
+    for (Code code = 0; code < dictionary.size(); ++code)
+    {
+      to_forest[feature].push_back(
+          dictionaries_[feature].find(dictionary.decode(code)));
+    }
+  }
+  auto send_left = [&](long idx, const Node& node)
+  {
+    int row = data.get_row(idx);
+    const Column& column = *columns[node.feature];
+    if (numeric_[node.feature]) return column.numbers[row] < node.value;
+    return in_mask(node, to_forest[node.feature][column.codes[row]]);
+  };
+  auto traverse_rows = [&](int tree, long begin, long end, int* votes)
+  {
+    traverse(tree, begin, end, send_left, votes);
+  };
+  guesses.resize(data.get_nrecords());
+  classify_blocked(data.get_nrecords(), traverse_rows, guesses.data(), votes);
+}
+
+void FlatForest::check_column(const Dataframe& data, int feature,
+    bool numeric)
+{
+  if (feature >= data.get_nattributes())
+  {
+    throw SelException(std::string("Data has ") +
+        std::to_string(data.get_nattributes()) +
+        " attributes, expected at least " + std::to_string(feature + 1));
+  }
+  const Attribute& attribute = data.get_attribute(feature);
+  if (attribute.numeric != numeric)
+  {
+    throw SelException(std::string("Attribute ") + attribute.name + " is " +
+        (attribute.numeric? "numeric" : "nominal") + ", expected " +
+        (numeric? "numeric" : "nominal"));
+  }
+  if (numeric) return;
+  const Column& column = data.get_root().get_column(feature);
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    if (column.codes[data.get_row(idx)] >= column.dictionary.size())
+    {
+      throw SelException(std::string("Attribute ") + attribute.name +
+          " has categories outside its dictionary");
+    }
+  }
+}
+
+void FlatForest::classify(const FeatureMatrix& matrix, Code* guesses,
+    int* votes) const
+{
+  if (matrix.ncolumns < numeric_.size())
+  {
+    throw SelException(std::string("Matrix has ") +
+        std::to_string(matrix.ncolumns) + " columns, expected at least " +
+        std::to_string(numeric_.size()));
+  }
+  long row_stride = 1, column_stride = 1;
+  if (matrix.layout == MatrixLayout::row_major) row_stride = matrix.ncolumns;
+  else column_stride = matrix.nrows;
+  /* Missing nominal values are encoded as the category "?", like in Table. */
+  std::vector<long> missing_codes(dictionaries_.size());
+  for (int feature = 0; feature < dictionaries_.size(); ++feature)
+  {
+    missing_codes[feature] = dictionaries_[feature].find("?");
+  }
+  auto send_left = [&](long row, const Node& node)
+  {
+    long offset = row*row_stride + node.feature*column_stride;
+    double x = matrix.values[offset];
+    bool missing = matrix.missing and matrix.missing[offset];
+    if (numeric_[node.feature]) return not missing and x < node.value;
+    if (missing) return in_mask(node, missing_codes[node.feature]);
+    if (not (x >= 0 and x < dictionaries_[node.feature].size())) return false;
+    long code = x;
+    return code == x and in_mask(node, code);
+  };
+  /* The vectorized kernel handles neither categories nor the mask (NaN
+   * values are fine, as they go right like missing values). */
+  bool simd = not matrix.missing and has_avx2();
+  auto traverse_rows = [&](int tree, long begin, long end, int* votes)
+  {
+    if (simd and numeric_trees_[tree])
+    {
+      traverse_avx2(tree, begin, end, matrix, row_stride, column_stride, votes);
+    }
+    else traverse(tree, begin, end, send_left, votes);
+  };
+  classify_blocked(matrix.nrows, traverse_rows, guesses, votes);
+}
+
+template <typename Traverse>
+void FlatForest::classify_blocked(long nrows, Traverse traverse,
+    Code* guesses, int* votes) const
+{
+  int nclasses = classes_.size();
+  /* The votes of each row add up across tiles, so they are kept for all the
+   * rows until the last tile. */
+  std::vector<int> buffer(votes? 0 : nrows*nclasses);
+  if (not votes) votes = buffer.data();
+  std::fill(votes, votes + nrows*nclasses, 0);
+  /* Every block of rows goes through the trees of a tile while their nodes
+   * are still in cache, before the next tile is visited. */
+  for (int tile = 0; tile + 1 < tiles_.size(); ++tile)
+  {
+    for (long begin = 0; begin < nrows; begin += block_rows)
+    {
+      long end = std::min(nrows, begin + block_rows);
+      for (int tree = tiles_[tile]; tree < tiles_[tile+1]; ++tree)
+      {
+        traverse(tree, begin, end, votes + begin*nclasses);
+      }
+    }
+  }
+  for (long row = 0; row < nrows; ++row)
+  {
+    guesses[row] = vote(votes + row*nclasses, nclasses);
+  }
+}
+
+template <typename SendLeft>
+void FlatForest::traverse(int tree, long begin, long end, SendLeft send_left,
+    int* votes) const
+{
+  int nclasses = classes_.size();
+  for (long row = begin; row < end; ++row)
+  {
+    const Node* node = &nodes_[roots_[tree]];
+    while (node->feature >= 0)
+    {
+      node = &nodes_[send_left(row, *node)? node->next : node->next + 1];
+    }
+    ++votes[(row - begin)*nclasses + node->next];
+  }
+}
+
+#ifdef SEL_AVX2_KERNEL
+
+__attribute__((target("avx2")))
+void FlatForest::traverse_avx2(int tree, long begin, long end,
+    const FeatureMatrix& matrix, long row_stride, long column_stride,
+    int* votes) const
+{
+  static_assert(sizeof(Node) == 16 and offsetof(Node, next) == 4 and
+      offsetof(Node, value) == 8, "Node layout assumed by the gathers");
+  const int* fields = reinterpret_cast<const int*>(nodes_);
+  const double* values = &nodes_->value;
+  int nclasses = classes_.size();
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i none = _mm_set1_epi32(-1);
+  const __m256i stride = _mm256_set1_epi64x(column_stride);
+  const __m256i low_halves = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  long row = begin;
+  /* Eight rows, in two independent groups of four (so that the latencies
+   * of their gathers overlap), go down the tree together: each node is
+   * replaced by next + (x >= thr), or kept for rows that already reached a
+   * leaf, until all of them reach a leaf. */
+  for (; row + 8 <= end; row += 8)
+  {
+    __m256i offsets[2];
+    __m128i node[2], feature[2], active[2];
+    for (int group = 0; group < 2; ++group)
+    {
+      long first = row + 4*group;
+      offsets[group] = _mm256_setr_epi64x(first*row_stride,
+          (first + 1)*row_stride, (first + 2)*row_stride,
+          (first + 3)*row_stride);
+      node[group] = _mm_set1_epi32(roots_[tree]);
+      feature[group] = _mm_i32gather_epi32(fields,
+          _mm_slli_epi32(node[group], 2), 4);
+      active[group] = _mm_cmpgt_epi32(feature[group], none);
+    }
+    __m128i any = _mm_or_si128(active[0], active[1]);
+    while (not _mm_testz_si128(any, any))
+    {
+      for (int group = 0; group < 2; ++group)
+      {
+        __m128i index = _mm_slli_epi32(node[group], 2);
+        __m128i next = _mm_i32gather_epi32(fields + 1, index, 4);
+        __m256d thr = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), values,
+            _mm_slli_epi32(node[group], 1),
+            _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+        __m256i offset = _mm256_add_epi64(offsets[group],
+            _mm256_mul_epi32(_mm256_cvtepi32_epi64(feature[group]), stride));
+        __m256d x = _mm256_mask_i64gather_pd(_mm256_setzero_pd(),
+            matrix.values, offset,
+            _mm256_castsi256_pd(_mm256_cvtepi32_epi64(active[group])), 8);
+        /* all ones for the rows that go left (never for NaN) */
+        __m256i left = _mm256_castpd_si256(_mm256_cmp_pd(x, thr, _CMP_LT_OQ));
+        left = _mm256_permutevar8x32_epi32(left, low_halves);
+        __m128i child = _mm_add_epi32(_mm_add_epi32(next, one),
+            _mm256_castsi256_si128(left));
+        node[group] = _mm_blendv_epi8(node[group], child, active[group]);
+        feature[group] = _mm_i32gather_epi32(fields,
+            _mm_slli_epi32(node[group], 2), 4);
+        active[group] = _mm_cmpgt_epi32(feature[group], none);
+      }
+      any = _mm_or_si128(active[0], active[1]);
+    }
+    alignas(16) int classes[8];
+    for (int group = 0; group < 2; ++group)
+    {
+      _mm_store_si128(reinterpret_cast<__m128i*>(classes + 4*group),
+          _mm_i32gather_epi32(fields + 1, _mm_slli_epi32(node[group], 2), 4));
+    }
+    for (int lane = 0; lane < 8; ++lane)
+    {
+      ++votes[(row + lane - begin)*nclasses + classes[lane]];
+    }
+  }
+  auto send_left = [&](long row, const Node& node)
+  {
+    return matrix.values[row*row_stride + node.feature*column_stride] <
+      node.value;
+  };
+  traverse(tree, row, end, send_left, votes + (row - begin)*nclasses);
+}
+
+bool FlatForest::has_avx2()
+{
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+#else
+
+void FlatForest::traverse_avx2(int tree, long begin, long end,
+    const FeatureMatrix& matrix, long row_stride, long column_stride,
+    int* votes) const
+{
+  throw SelException("AVX2 kernel not available");
+}
+
+bool FlatForest::has_avx2()
+{
+  return false;
+}
+
+#endif
+
+Code FlatForest::vote(const int* votes, int nclasses)
+{
+  Code best = 0;
+  for (Code code = 1; code < nclasses; ++code)
+  {
+    if (votes[code] > votes[best]) best = code;
+  }
+  return best;
+}
+
+}
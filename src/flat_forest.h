@@ -0,0 +1,248 @@
+#ifndef FLAT_FOREST_H
+#define FLAT_FOREST_H
+
+#include "tree.h"
+
+#include <cstdint>
+#include <memory>
+
+namespace sel
+{
+
+enum class MatrixLayout { row_major, column_major };
+
+/**
+ * @brief Dense matrix with the attributes of some records, not owned.
+ *
+ * Columns follow the attributes of the training data (the column of the
+ * target is ignored). Numeric attributes hold numbers and nominal attributes
+ * the Code of their category in FlatForest::get_dictionary (any other value
+ * stands for a category unknown to the forest, which goes right).
+ */
+struct FeatureMatrix
+{
+  const double* values;
+  int nrows;
+  int ncolumns;
+  MatrixLayout layout;
+  /* Optional, with the same layout as values: nonzero for missing values. */
+  const std::uint8_t* missing;
+};
+
+/**
+ * @brief Immutable representation of the trees of a forest, used for
+ * prediction.
+ *
+ * The nodes of all the trees are stored in one contiguous array, each tree in
+ * breadth-first order with both children of a node next to each other.
+ * Leaves hold the index of their class instead of its name, so classifying a
+ * record neither follows pointers to heap-allocated nodes nor copies strings.
+ *
+ * The same arrays make up the binary model format (see save), so a saved
+ * forest is mapped into memory and used as is, without parsing its nodes.
+ * Copies share the (immutable) nodes.
+ */
+class FlatForest
+{
+  public:
+
+    typedef std::unique_ptr<FlatForest> Ptr;
+
+    FlatForest() : nodes_(nullptr), nnodes_(0), masks_(nullptr), nmasks_(0) {}
+
+    explicit FlatForest(const std::vector<DecisionTree::Ptr>& trees);
+
+    /**
+     * @brief Forest made of the given trees of forest, which shares its
+     * nodes and keeps its codes of classes and categories.
+     */
+    FlatForest(const FlatForest& forest, const std::vector<int>& trees);
+
+    /**
+     * @brief Maps a forest saved in binary format into memory (throws
+     * SelException if the file is not a valid model).
+     */
+    static Ptr load(const std::string& filename);
+
+    /**
+     * @return Whether the file starts like a model in binary format.
+     */
+    static bool is_binary(const std::string& filename);
+
+    /**
+     * @brief Saves the forest in binary format.
+     *
+     * The format is little-endian: a header ("SELFRST" magic, version, sizes)
+     * followed by the roots of the trees, the array of nodes (16 bytes each,
+     * 8-byte aligned) and the bitsets of the categorical nodes (64-bit
+     * words), then the table of strings (classes, and name and categories of
+     * the attributes).
+     */
+    void save(const std::string& filename) const;
+
+    /**
+     * @return A DecisionTree equivalent to the given tree.
+     */
+    DecisionTree::Ptr get_tree(int tree) const;
+
+    int get_ntrees() const { return roots_.size(); }
+
+    /**
+     * @return Classes guessed by the leaves, encoded in lexicographic order.
+     */
+    const Dictionary& get_classes() const { return classes_; }
+
+    /**
+     * @return Categories of a nominal attribute that some node tests, which
+     * define the codes of that attribute in a FeatureMatrix.
+     */
+    const Dictionary& get_dictionary(int column) const;
+
+    /**
+     * @return Code of the class guessed by the given tree for instance.
+     */
+    Code classify(int tree, const Instance& instance) const;
+
+    /**
+     * @brief Majority vote of the trees (ties are broken in favour of the
+     * lowest code).
+     *
+     * @param votes Set to the number of votes received by each class.
+     */
+    Code classify(const Instance& instance, std::vector<int>& votes) const;
+
+    /**
+     * @brief Majority vote of the trees for each record of data, whose
+     * categories are matched by name with those of the forest (throws
+     * SelException if the attributes tested by the forest are missing from
+     * data or have another type, see check_column).
+     *
+     * @param votes If not null, set to the votes received by each class
+     * (nrecords x get_classes().size() entries, record after record).
+     */
+    void classify(const Dataframe& data, std::vector<Code>& guesses,
+        int* votes=nullptr) const;
+
+    /**
+     * @brief Majority vote of the trees for each row of matrix. Nothing is
+     * allocated per row.
+     *
+     * Without a missing mask (missing numbers can be given as NaN instead),
+     * trees without categorical nodes are traversed by eight rows at a time
+     * with AVX2 if the CPU supports it.
+     *
+     * @param guesses Set to the Code of the class of each row (nrows
+     * entries).
+     * @param votes If not null, set to the votes received by each class
+     * (nrows x get_classes().size() entries, row after row).
+     */
+    void classify(const FeatureMatrix& matrix, Code* guesses,
+        int* votes=nullptr) const;
+
+    /**
+     * @brief Throws SelException unless data has the given attribute, with
+     * the given type and, if it is nominal, codes of its dictionary.
+     */
+    static void check_column(const Dataframe& data, int feature,
+        bool numeric);
+
+    /**
+     * @brief Sets the size of the nodes of a tile of batch classification
+     * (default_tile_bytes unless set): the trees are split into tiles of
+     * consecutive trees, each one starting once the previous one has at
+     * least bytes of nodes, and blocks of rows go through a tile at a time.
+     */
+    void set_tile_bytes(long bytes);
+
+    /**
+     * @return Number of tiles of batch classification.
+     */
+    int get_ntiles() const { return tiles_.size() - 1; }
+
+    /* Fits the L2 cache of most CPUs. */
+    static const long default_tile_bytes = 256*1024;
+
+  private:
+
+    struct Node
+    {
+      /* Attribute tested by the node, -1 for leaves. */
+      std::int32_t feature;
+      /* Index of the left child (the right one follows it), or Code of the
+       * class for leaves. */
+      std::int32_t next;
+      /* Threshold of numeric attributes, or offset in masks_ of the bitset
+       * of the categories sent left (indexed by their Code in
+       * dictionaries_[feature]). */
+      double value;
+    };
+
+    /* Whether the category with the given code in dictionaries_ (-1 if
+     * unknown) goes to the left of a categorical node. */
+    bool in_mask(const Node& node, long code) const
+    {
+      if (code < 0) return false;
+      const std::uint64_t* mask = masks_ + (long)node.value;
+      return mask[code/64] >> (code%64) & 1;
+    }
+
+    /* Number of words of the bitsets of a nominal attribute. */
+    long mask_words(int feature) const
+    {
+      return (dictionaries_[feature].size() + 63)/64;
+    }
+
+    /* Rows of the blocks of batch classification, which go through the
+     * trees of a tile while they stay in cache. */
+    static const int block_rows = 64;
+
+    /* traverse(tree, begin, end, votes) adds the votes of tree for rows
+     * [begin, end), votes pointing to those of row begin. */
+    template <typename Traverse>
+    void classify_blocked(long nrows, Traverse traverse, Code* guesses,
+        int* votes) const;
+
+    /* send_left(row, node) tells whether row goes to the left of node. */
+    template <typename SendLeft>
+    void traverse(int tree, long begin, long end, SendLeft send_left,
+        int* votes) const;
+
+    /* Same as traverse, for a tree without categorical nodes, several rows
+     * at once with AVX2 gathers (available if has_avx2()). */
+    void traverse_avx2(int tree, long begin, long end,
+        const FeatureMatrix& matrix, long row_stride, long column_stride,
+        int* votes) const;
+
+    static bool has_avx2();
+
+    static Code vote(const int* votes, int nclasses);
+
+    DecisionTree* get_subtree(int node) const;
+
+    void make_tiles();
+
+    const Node* nodes_;
+    int nnodes_;
+    const std::uint64_t* masks_;
+    long nmasks_;
+    /* Owner of nodes_ and masks_: vectors, or the mapping of a file. */
+    std::shared_ptr<const void> storage_;
+    std::vector<int> roots_;
+    /* Whether each tree has only numeric nodes. */
+    std::vector<char> numeric_trees_;
+    /* First tree of each tile, followed by the number of trees. */
+    std::vector<int> tiles_;
+    long tile_bytes_ = default_tile_bytes;
+    /* Whether each attribute is numeric (indexed by feature). */
+    std::vector<char> numeric_;
+    /* Categories sent left by the nodes (indexed by feature). */
+    std::vector<Dictionary> dictionaries_;
+    /* Names of the attributes (indexed by feature). */
+    std::vector<std::string> names_;
+    Dictionary classes_;
+
+};
+
+}
+
+#endif
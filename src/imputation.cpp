@@ -19,12 +19,13 @@ MedianModeImputation::MedianModeImputation(const Dataframe& data)
     const Attribute& attr = data.get_attribute(idx);
     if (attr.numeric)
     {
+      const Column& column = data.get_root().get_column(idx);
       std::vector<double> all_values;
       all_values.reserve(data.get_nrecords());
       for (int jdx = 0; jdx < data.get_nrecords(); ++jdx)
       {
-        const Value& value = data.get_instance(jdx).get(idx);
-        if (not value.is_missing()) all_values.push_back(value.get_number());
+        int row = data.get_row(jdx);
+        if (not column.missing[row]) all_values.push_back(column.numbers[row]);
       }
       std::sort(all_values.begin(), all_values.end());
       double median = all_values[all_values.size()/2];
@@ -32,16 +33,21 @@ MedianModeImputation::MedianModeImputation(const Dataframe& data)
     }
     else
     {
-      CategoryFrequency density;
-      data.category_freq(idx, density);
+      const Column& column = data.get_root().get_column(idx);
+      CategoryFrequency counts(column.dictionary.size(), 0);
+      for (int jdx = 0; jdx < data.get_nrecords(); ++jdx)
+      {
+        int row = data.get_row(jdx);
+        if (not column.missing[row]) counts[column.codes[row]] += 1;
+      }
       std::string mode;
-      double max_density = 0;
-      for (const auto& entry : density)
+      double max_count = 0;
+      for (Code code = 0; code < counts.size(); ++code)
       {
-        if (entry.first != "?" and entry.second > max_density)
+        if (counts[code] > max_count)
         {
-          mode = entry.first;
-          max_density = entry.second;
+          mode = column.dictionary.decode(code);
+          max_count = counts[code];
         }
       }
       substitutes_.push_back(Value::Ptr(new Category(mode)));
@@ -51,15 +57,12 @@ MedianModeImputation::MedianModeImputation(const Dataframe& data)
 
 void MedianModeImputation::operator()(Dataframe& data)
 {
-  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  for (int jdx = 0; jdx < data.get_nattributes(); ++jdx)
   {
-    for (int jdx = 0; jdx < data.get_nattributes(); ++jdx)
+    const ColumnData<std::uint8_t>& missing = data.get_root().get_column(jdx).missing;
+    for (int idx = 0; idx < data.get_nrecords(); ++idx)
     {
-      const Value& val = data.get_instance(idx).get(jdx);
-      if (val.is_missing())
-      {
-        data[idx].set(jdx, substitutes_[jdx]->clone());
-      }
+      if (missing[data.get_row(idx)]) data[idx].set(jdx, *substitutes_[jdx]);
     }
   }
 }
@@ -35,21 +35,25 @@ class PerClass : public ImputationMethod
 
     PerClass(const Dataframe& data)
     {
+      const Dictionary& classes = get_classes(data);
       Dataframe::Partition part;
       data.partition(data.get_target_idx(), part);
-      for (const auto& entry : part)
+      for (Code code = 0; code < part.size(); ++code)
       {
-        per_class_methods_[entry.first] = new Method(*entry.second);
+        if (not part[code]) continue;
+        per_class_methods_[classes.decode(code)] = new Method(*part[code]);
       }
     }
 
     virtual void operator()(Dataframe& data) override
     {
+      const Dictionary& classes = get_classes(data);
       Dataframe::Partition part;
       data.partition(data.get_target_idx(), part);
-      for (const auto& entry : part)
+      for (Code code = 0; code < part.size(); ++code)
       {
-        (*per_class_methods_[entry.first])(*entry.second);
+        if (not part[code]) continue;
+        (*per_class_methods_[classes.decode(code)])(*part[code]);
       }
     }
 
@@ -63,6 +67,11 @@ class PerClass : public ImputationMethod
 
   private:
 
+    static const Dictionary& get_classes(const Dataframe& data)
+    {
+      return data.get_root().get_column(data.get_target_idx()).dictionary;
+    }
+
     std::map<std::string, Method*> per_class_methods_;
 };
 
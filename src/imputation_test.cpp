@@ -1,5 +1,4 @@
 #include "imputation.h"
-#include <cstdlib>
 #include <iostream>
 
 #ifndef DATA_PATH
@@ -8,7 +7,6 @@
 
 int main(int argc, char* argv[])
 {
-  srand(42);
   if (argc != 2)
   {
     std::cerr << "Usage: " << argv[0] << " datasetname\n";
@@ -19,8 +17,6 @@ int main(int argc, char* argv[])
     std::string datafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".data";
     std::string metafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".meta";
 
-    std::srand(42);
-
     sel::Table table(datafile, metafile);
     std::cout << table << std::endl;
 
@@ -0,0 +1,245 @@
+#include "quick_scorer.h"
+
+#include <algorithm>
+
+namespace sel
+{
+
+namespace /* utils for internal usage */
+{
+
+// number of leaves of tree, counted up to limit + 1
+int count_leaves(const DecisionTree& tree, int limit)
+{
+  if (not tree.get_stump()) return 1;
+  int nleaves = count_leaves(tree.get_left(), limit);
+  if (nleaves > limit) return nleaves;
+  return nleaves + count_leaves(tree.get_right(), limit - nleaves);
+}
+
+}
+
+QuickScorer::QuickScorer(const RandomForest& forest) :
+  classes_(forest.get_classes())
+{
+  const std::vector<DecisionTree::Ptr>& trees = forest.get_trees();
+  std::vector<int> large;
+  for (int tree = 0; tree < trees.size(); ++tree)
+  {
+    if (count_leaves(*trees[tree], max_leaves) > max_leaves)
+    {
+      large.push_back(tree);
+      continue;
+    }
+    int nleaves = 0;
+    leaves_.emplace_back();
+    compile(forest, *trees[tree], leaves_.size() - 1, nleaves);
+  }
+  if (not large.empty()) large_ = FlatForest(forest.get_flat(), large);
+  for (int feature = 0; feature < conditions_.size(); ++feature)
+  {
+    if (not numeric_[feature]) continue;
+    std::vector<Condition>& conditions = conditions_[feature];
+    auto cmp = [](const Condition& a, const Condition& b)
+    {
+      return a.value < b.value;
+    };
+    std::sort(conditions.begin(), conditions.end(), cmp);
+  }
+}
+
+void QuickScorer::compile(const RandomForest& forest, const DecisionTree& tree,
+    int index, int& nleaves)
+{
+  const DecisionStump* stump = tree.get_stump();
+  if (not stump)
+  {
+    leaves_[index].push_back(classes_.find(tree.get_guess()));
+    ++nleaves;
+    return;
+  }
+  int first = nleaves;
+  /* The right subtree has at least one leaf, so the left one has less than
+   * max_leaves for the shift below. */
+  compile(forest, tree.get_left(), index, nleaves);
+  std::uint64_t left = ((std::uint64_t(1) << (nleaves - first)) - 1) << first;
+  int feature = stump->get_split();
+  if (conditions_.size() <= feature)
+  {
+    conditions_.resize(feature + 1);
+    numeric_.resize(feature + 1, 0);
+    dictionaries_.resize(feature + 1);
+  }
+  Condition condition;
+  condition.tree = index;
+  condition.mask = ~left;
+  if (stump->get_attribute().numeric)
+  {
+    numeric_[feature] = 1;
+    condition.value =
+      static_cast<const NumericDecisionStump*>(stump)->get_threshold();
+  }
+  else
+  {
+    if (conditions_[feature].empty())
+    {
+      dictionaries_[feature] = forest.get_dictionary(feature);
+    }
+    long offset = masks_.size();
+    condition.value = offset;
+    masks_.resize(offset + (dictionaries_[feature].size() + 63)/64, 0);
+    for (const std::string& category :
+        static_cast<const CategoricalDecisionStump*>(stump)->get_to_left())
+    {
+      long code = dictionaries_[feature].find(category);
+      masks_[offset + code/64] |= std::uint64_t(1) << code%64;
+    }
+  }
+  conditions_[feature].push_back(condition);
+  compile(forest, tree.get_right(), index, nleaves);
+}
+
+void QuickScorer::classify(const Dataframe& data,
+    std::vector<Code>& guesses) const
+{
+  const Table& root = data.get_root();
+  std::vector<const Column*> columns(conditions_.size());
+  /* Code, in the dictionaries of the forest, of the categories of data (-1
+   * for those unknown to the forest). */
+  std::vector<std::vector<double>> to_forest(conditions_.size());
+  for (int feature = 0; feature < conditions_.size(); ++feature)
+  {
+    if (conditions_[feature].empty()) continue;
+    FlatForest::check_column(data, feature, numeric_[feature]);
+    columns[feature] = &root.get_column(feature);
+    if (numeric_[feature]) continue;
+    const Dictionary& dictionary = columns[feature]->dictionary;
+    for (Code code = 0; code < dictionary.size(); ++code)
+    {
+      to_forest[feature].push_back(
+          dictionaries_[feature].find(dictionary.decode(code)));
+    }
+  }
+  auto number = [&](long idx, int feature)
+  {
+    return columns[feature]->numbers[data.get_row(idx)];
+  };
+  auto code = [&](long idx, int feature)
+  {
+    return to_forest[feature][columns[feature]->codes[data.get_row(idx)]];
+  };
+  guesses.resize(data.get_nrecords());
+  std::vector<int> large_votes;
+  if (large_.get_ntrees() > 0)
+  {
+    large_votes.resize(data.get_nrecords()*classes_.size());
+    large_.classify(data, guesses, large_votes.data());
+  }
+  score(data.get_nrecords(), number, code,
+      large_votes.empty()? nullptr : large_votes.data(), guesses.data(),
+      nullptr);
+}
+
+void QuickScorer::classify(const FeatureMatrix& matrix, Code* guesses,
+    int* votes) const
+{
+  if (matrix.ncolumns < conditions_.size())
+  {
+    throw SelException(std::string("Matrix has ") +
+        std::to_string(matrix.ncolumns) + " columns, expected at least " +
+        std::to_string(conditions_.size()));
+  }
+  long row_stride = 1, column_stride = 1;
+  if (matrix.layout == MatrixLayout::row_major) row_stride = matrix.ncolumns;
+  else column_stride = matrix.nrows;
+  /* Missing nominal values are encoded as the category "?", like in Table. */
+  std::vector<double> missing_codes(dictionaries_.size());
+  for (int feature = 0; feature < dictionaries_.size(); ++feature)
+  {
+    missing_codes[feature] = dictionaries_[feature].find("?");
+  }
+  auto number = [&](long row, int feature)
+  {
+    long offset = row*row_stride + feature*column_stride;
+    if (matrix.missing and matrix.missing[offset]) return std::numeric_limits<double>::quiet_NaN();
+    return matrix.values[offset];
+  };
+  auto code = [&](long row, int feature)
+  {
+    long offset = row*row_stride + feature*column_stride;
+    if (matrix.missing and matrix.missing[offset]) return missing_codes[feature];
+    return matrix.values[offset];
+  };
+  std::vector<int> large_votes;
+  if (large_.get_ntrees() > 0)
+  {
+    large_votes.resize((long)matrix.nrows*classes_.size());
+    large_.classify(matrix, guesses, large_votes.data());
+  }
+  score(matrix.nrows, number, code,
+      large_votes.empty()? nullptr : large_votes.data(), guesses, votes);
+}
+
+template <typename Number, typename Code_>
+void QuickScorer::score(long nrows, Number number, Code_ code,
+    const int* large_votes, Code* guesses, int* votes) const
+{
+  int nclasses = classes_.size();
+  std::vector<std::uint64_t> bitvectors(leaves_.size());
+  std::vector<int> buffer(votes? 0 : nclasses);
+  for (long row = 0; row < nrows; ++row)
+  {
+    std::fill(bitvectors.begin(), bitvectors.end(), ~std::uint64_t(0));
+    for (int feature = 0; feature < conditions_.size(); ++feature)
+    {
+      const std::vector<Condition>& conditions = conditions_[feature];
+      if (conditions.empty()) continue;
+      if (numeric_[feature])
+      {
+        /* Conditions x < thr are false up to the first threshold above x
+         * (all of them for NaN, which goes right). */
+        double x = number(row, feature);
+        for (const Condition& condition : conditions)
+        {
+          if (x < condition.value) break;
+          bitvectors[condition.tree] &= condition.mask;
+        }
+      }
+      else
+      {
+        /* Unknown categories go right, like those outside the sets. */
+        double x = code(row, feature);
+        bool known = x >= 0 and x < dictionaries_[feature].size() and
+          x == (long)x;
+        long category = known? x : 0;
+        for (const Condition& condition : conditions)
+        {
+          const std::uint64_t* mask = &masks_[(long)condition.value];
+          if (not known or not (mask[category/64] >> (category%64) & 1))
+          {
+            bitvectors[condition.tree] &= condition.mask;
+          }
+        }
+      }
+    }
+    int* row_votes = votes? votes + row*nclasses : buffer.data();
+    if (large_votes)
+    {
+      const int* row_large = large_votes + row*nclasses;
+      std::copy(row_large, row_large + nclasses, row_votes);
+    }
+    else std::fill(row_votes, row_votes + nclasses, 0);
+    for (int tree = 0; tree < leaves_.size(); ++tree)
+    {
+      ++row_votes[leaves_[tree][__builtin_ctzll(bitvectors[tree])]];
+    }
+    Code best = 0;
+    for (Code class_ = 1; class_ < nclasses; ++class_)
+    {
+      if (row_votes[class_] > row_votes[best]) best = class_;
+    }
+    guesses[row] = best;
+  }
+}
+
+}
@@ -0,0 +1,93 @@
+#ifndef QUICK_SCORER_H
+#define QUICK_SCORER_H
+
+#include "random_forest.h"
+
+#include <cstdint>
+
+namespace sel
+{
+
+/**
+ * @brief Evaluation engine for forests of small trees (QuickScorer).
+ *
+ * Instead of traversing each tree, the conditions of all the nodes are
+ * grouped by attribute (numeric thresholds in increasing order), and every
+ * node whose condition is false for a record clears the leaves of its left
+ * subtree from a bitvector of its tree. The exit leaf of each tree is then
+ * the leftmost one still set. Trees with more leaves than a bitvector holds
+ * are traversed instead (see FlatForest). Predictions are identical to those
+ * of RandomForest::classify.
+ */
+class QuickScorer
+{
+  public:
+
+    /* Leaves of a tree must fit in a bitvector. */
+    static const int max_leaves = 64;
+
+    /**
+     * @brief Compiles the trees of forest with up to max_leaves leaves.
+     */
+    explicit QuickScorer(const RandomForest& forest);
+
+    /**
+     * @return Classes, the same as those of the forest.
+     */
+    const Dictionary& get_classes() const { return classes_; }
+
+    /**
+     * @brief Majority vote of the trees for each record of data (throws
+     * SelException like FlatForest::classify if data does not have the
+     * attributes of the forest).
+     */
+    void classify(const Dataframe& data, std::vector<Code>& guesses) const;
+
+    /**
+     * @brief Majority vote of the trees for each row of matrix, which is
+     * encoded like for RandomForest::classify.
+     */
+    void classify(const FeatureMatrix& matrix, Code* guesses,
+        int* votes=nullptr) const;
+
+  private:
+
+    struct Condition
+    {
+      /* Threshold, or offset in masks_ of the bitset of the categories (by
+       * Code in the dictionary of the forest) that go left. */
+      double value;
+      int tree;
+      /* Leaves remaining if the condition is false. */
+      std::uint64_t mask;
+    };
+
+    /* Adds the leaves and conditions of a tree of forest, numbering its
+     * leaves from nleaves. */
+    void compile(const RandomForest& forest, const DecisionTree& tree,
+        int index, int& nleaves);
+
+    /* number(row, feature) and code(row, feature) give the values of each
+     * row, the code being -1 for unknown categories. large_votes, if not
+     * null, holds the votes of the trees of large_ for each row. */
+    template <typename Number, typename Code_>
+    void score(long nrows, Number number, Code_ code, const int* large_votes,
+        Code* guesses, int* votes) const;
+
+    /* Conditions of the nodes of each attribute (sorted by threshold for
+     * numeric attributes). */
+    std::vector<std::vector<Condition>> conditions_;
+    std::vector<char> numeric_;
+    /* Class of the leaves of each tree, from left to right. */
+    std::vector<std::vector<Code>> leaves_;
+    Dictionary classes_;
+    std::vector<Dictionary> dictionaries_;
+    std::vector<std::uint64_t> masks_;
+    /* Trees with more than max_leaves leaves, with the codes of classes_. */
+    FlatForest large_;
+
+};
+
+}
+
+#endif
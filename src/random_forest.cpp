@@ -1,74 +1,368 @@
 #include "random_forest.h"
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
 
 namespace sel
 {
 
+namespace /* utils for internal usage */
+{
+
+/* Code of the class guessed by tree for each record of data that has been
+ * left out of its bootstrap sample (-1 for the records in the sample). */
+void classify_out_of_bag(const Dataframe& data, const DecisionTree& tree,
+    const std::vector<double>& counts, std::vector<long>& guesses)
+{
+  const Dictionary& classes =
+    data.get_root().get_column(data.get_target_idx()).dictionary;
+  guesses.assign(data.get_nrecords(), -1);
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    if (counts[data.get_row(idx)] > 0) continue;
+    guesses[idx] = classes.find(tree.classify(data.get_instance(idx)));
+  }
+}
+
+/* Builds the trees of a JSON forest from the events of the parser, node by
+ * node, discarding the parsed values so that no document is built. */
+class JsonForestReader
+{
+  public:
+
+    JsonForestReader(const std::string& filename,
+        std::vector<DecisionTree::Ptr>& trees) :
+      filename_(filename), trees_(trees) {}
+
+    bool operator()(int depth, json::parse_event_t event, json& parsed)
+    {
+      switch (event)
+      {
+        case json::parse_event_t::object_start:
+          stack_.emplace_back();
+          return true;
+        case json::parse_event_t::key:
+          if (not stack_.empty()) stack_.back().key = parsed.get<std::string>();
+          return true;
+        case json::parse_event_t::value:
+          if (not stack_.empty()) set_field(stack_.back(), parsed);
+          return false;
+        case json::parse_event_t::object_end:
+          end_object();
+          return false;
+        default:
+          return true;
+      }
+    }
+
+  private:
+
+    /* Fields of an object being read (a tree, a stump or an attribute) */
+    struct Frame
+    {
+      Frame() : numeric(false), split(-1), thr(0), has_guess(false),
+        has_thr(false), has_to_left(false) {}
+
+      std::string key;
+      DecisionTree::Ptr left, right;
+      DecisionStump::Ptr stump;
+      std::string guess, name;
+      std::vector<std::string> to_left;
+      bool numeric;
+      int split;
+      double thr;
+      bool has_guess, has_thr, has_to_left;
+    };
+
+    void set_field(Frame& frame, const json& value)
+    {
+      if (frame.key == "guess" and value.is_string())
+      {
+        frame.guess = value.get<std::string>();
+        frame.has_guess = true;
+      }
+      else if (frame.key == "name" and value.is_string())
+      {
+        frame.name = value.get<std::string>();
+      }
+      else if (frame.key == "numeric" and value.is_boolean())
+      {
+        frame.numeric = value.get<bool>();
+      }
+      else if (frame.key == "split" and value.is_number())
+      {
+        frame.split = value.get<int>();
+      }
+      else if (frame.key == "thr" and value.is_number())
+      {
+        frame.thr = value.get<double>();
+        frame.has_thr = true;
+      }
+      else if (frame.key == "to_left" and value.is_string())
+      {
+        /* Either a single category or the elements of an array. */
+        frame.to_left.push_back(value.get<std::string>());
+        frame.has_to_left = true;
+      }
+    }
+
+    void end_object()
+    {
+      Frame frame = std::move(stack_.back());
+      stack_.pop_back();
+      std::string key = stack_.empty()? "" : stack_.back().key;
+      if (key == "attr")
+      {
+        stack_.back().name = frame.name;
+        stack_.back().numeric = frame.numeric;
+      }
+      else if (key == "stump")
+      {
+        if (frame.split < 0) invalid();
+        if (frame.numeric and frame.has_thr)
+        {
+          stack_.back().stump.reset(
+              new NumericDecisionStump(frame.name, frame.split, frame.thr));
+        }
+        else if (not frame.numeric and frame.has_to_left)
+        {
+          stack_.back().stump.reset(new CategoricalDecisionStump(frame.name,
+                frame.split, frame.to_left));
+        }
+        else invalid();
+      }
+      else
+      {
+        DecisionTree::Ptr tree;
+        if (frame.stump and frame.left and frame.right)
+        {
+          tree.reset(new DecisionTree(frame.stump.release(),
+                frame.left.release(), frame.right.release()));
+        }
+        else if (not frame.stump and frame.has_guess)
+        {
+          tree.reset(new DecisionTree(frame.guess));
+        }
+        else invalid();
+        if (key == "left") stack_.back().left = std::move(tree);
+        else if (key == "right") stack_.back().right = std::move(tree);
+        else if (stack_.empty()) trees_.push_back(std::move(tree));
+        else invalid();
+      }
+    }
+
+    void invalid() const
+    {
+      throw SelException(std::string("File ")+filename_+
+          " does not contain a valid forest");
+    }
+
+    std::string filename_;
+    std::vector<DecisionTree::Ptr>& trees_;
+    std::vector<Frame> stack_;
+};
+
+std::string quote(const std::string& str)
+{
+  std::string quoted = "\"";
+  for (char c : str)
+  {
+    if (c == '"' or c == '\\') quoted += '\\';
+    quoted += c;
+  }
+  return quoted + '"';
+}
+
+int count_attributes(const DecisionTree& tree)
+{
+  const DecisionStump* stump = tree.get_stump();
+  if (not stump) return 0;
+  return std::max(stump->get_split() + 1, std::max(
+        count_attributes(tree.get_left()), count_attributes(tree.get_right())));
+}
+
+/* Writes the body of a function returning the class guessed by tree for x
+ * (codes of the classes and categories as in the flat forest). */
+void tree_to_cpp(const DecisionTree& tree, const FlatForest& flat, int indent,
+    std::ostream& out)
+{
+  std::string pre(indent, ' ');
+  const DecisionStump* stump = tree.get_stump();
+  if (not stump)
+  {
+    out << pre << "return " << flat.get_classes().find(tree.get_guess()) <<
+      "; // " << tree.get_guess() << '\n';
+    return;
+  }
+  int split = stump->get_split();
+  out << pre << "if (x[" << split << "] ";
+  if (stump->get_attribute().numeric)
+  {
+    out << "< " << static_cast<const NumericDecisionStump*>(stump)->
+      get_threshold();
+  }
+  else
+  {
+    std::vector<std::string> to_left =
+      static_cast<const CategoricalDecisionStump*>(stump)->get_to_left();
+    for (int idx = 0; idx < to_left.size(); ++idx)
+    {
+      if (idx) out << " or x[" << split << "] ";
+      out << "== " << flat.get_dictionary(split).find(to_left[idx]);
+    }
+  }
+  out << ") // " << *stump << '\n';
+  out << pre << "{\n";
+  tree_to_cpp(tree.get_left(), flat, indent + 2, out);
+  out << pre << "}\n" << pre << "else\n" << pre << "{\n";
+  tree_to_cpp(tree.get_right(), flat, indent + 2, out);
+  out << pre << "}\n";
+}
+
+} /* end anonymous namespace */
+
 RandomForest::RandomForest(const Dataframe& data, int ntrees, int f, int n,
-    Metric m) : forest_(ntrees)
+    Metric m, int threads, const Rng& rng, bool bootstrap,
+    SplitSearch search) :
+  forest_(ntrees), oob_accuracy_(std::numeric_limits<double>::quiet_NaN())
 {
   if (f <= 0)
   {
     f = (int)std::round(std::sqrt(data.get_nattributes()));
   }
-  for (auto& tree : forest_)
+  if (bootstrap)
+  {
+    const Dictionary& classes =
+      data.get_root().get_column(data.get_target_idx()).dictionary;
+    oob_votes_.assign(data.get_nrecords(), CategoryFrequency(classes.size(), 0));
+  }
+  std::unique_ptr<SortedColumns> sorted;
+  std::unique_ptr<BinnedColumns> binned;
+  if (search == SplitSearch::presorted) sorted.reset(new SortedColumns(data));
+  if (search == SplitSearch::histogram) binned.reset(new BinnedColumns(data));
+  std::mutex oob_mtx;
+  auto train_tree = [&](int idx)
+  {
+    Rng tree_rng = rng.split(idx);
+    if (bootstrap)
+    {
+      /* Multiplicity of each row in the sample, instead of copies. */
+      std::vector<double> counts(data.get_root().get_nrecords(), 0);
+      for (int jdx = 0; jdx < data.get_nrecords(); ++jdx)
+      {
+        counts[data.get_row(tree_rng.uniform(data.get_nrecords()))] += 1;
+      }
+      std::vector<double> weights(counts);
+      View sample(data, std::move(weights));
+      forest_[idx].reset(
+          new DecisionTree(sample, n, f, m, tree_rng, sorted.get(),
+            binned.get()));
+      std::vector<long> guesses;
+      classify_out_of_bag(data, *forest_[idx], counts, guesses);
+      /* Votes are integral, so the order in which trees add them does not
+       * matter. */
+      std::lock_guard<std::mutex> lock(oob_mtx);
+      for (int jdx = 0; jdx < guesses.size(); ++jdx)
+      {
+        if (guesses[jdx] >= 0) oob_votes_[jdx][guesses[jdx]] += 1;
+      }
+    }
+    else
+    {
+      forest_[idx].reset(
+          new DecisionTree(data, n, f, m, tree_rng, sorted.get(),
+            binned.get()));
+    }
+  };
+  parallel_for(ntrees, threads, train_tree);
+  flat_ = FlatForest(forest_);
+  if (bootstrap) compute_oob_accuracy(data);
+}
+
+void RandomForest::compute_oob_accuracy(const Dataframe& data)
+{
+  int target_idx = data.get_target_idx();
+  int hits = 0, total = 0;
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
   {
-    tree.reset(new DecisionTree(data, n, f, m));
+    const CategoryFrequency& votes = oob_votes_[idx];
+    auto most_voted = std::max_element(votes.begin(), votes.end());
+    if (*most_voted == 0) continue; // never out of bag
+    Code guess = most_voted - votes.begin();
+    if (guess == data.get_instance(idx).get_code(target_idx)) ++hits;
+    ++total;
   }
+  if (total > 0) oob_accuracy_ = hits / (double)total;
 }
 
 RandomForest::Ptr RandomForest::load(const std::string& filename)
 {
-  json forest_json;
+  if (FlatForest::is_binary(filename))
+  {
+    /* The nodes stay mapped and classify from there; the trees are only
+     * built if get_trees is called, e.g. to export the forest. */
+    Ptr ret(new RandomForest);
+    ret->flat_ = *FlatForest::load(filename);
+    return ret;
+  }
   std::ifstream file(filename);
   if (not file)
   {
     throw SelException(std::string("File ")+filename+" cannot be loaded");
   }
-  file >> forest_json;
   Ptr ret(new RandomForest);
-  for (json& tree : forest_json)
+  JsonForestReader reader(filename, ret->forest_);
+  try
   {
-    ret->forest_.emplace_back(new DecisionTree(tree));
+    json::parse(file, std::ref(reader));
   }
+  catch (json::exception& e)
+  {
+    throw SelException(std::string("File ")+filename+": "+e.what());
+  }
+  ret->flat_ = FlatForest(ret->forest_);
   return ret;
 }
 
 std::string RandomForest::classify(const Instance& instance) const
 {
-  std::map<std::string, int> votes;
-  for (const auto& tree : forest_)
-  {
-    std::string guess = tree->classify(instance);
-    ++votes[guess];
-  }
-  int max_votes = 0;
-  std::string most_frequent;
-  for (const auto& entry : votes)
-  {
-    if (entry.second > max_votes)
-    {
-      max_votes = entry.second;
-      most_frequent = entry.first;
-    }
-  }
-  return most_frequent;
+  if (flat_.get_ntrees() == 0) return std::string();
+  std::vector<int> votes;
+  return flat_.get_classes().decode(flat_.classify(instance, votes));
 }
 
 void RandomForest::classify(const Dataframe& data,
     std::vector<std::string>& guesses) const
 {
-  guesses.resize(data.get_nrecords());
+  guesses.assign(data.get_nrecords(), std::string());
+  if (flat_.get_ntrees() == 0) return;
+  std::vector<Code> codes;
+  flat_.classify(data, codes);
   for (int idx = 0; idx < data.get_nrecords(); ++idx)
   {
-    guesses[idx] = classify(data.get_instance(idx));
+    guesses[idx] = flat_.get_classes().decode(codes[idx]);
   }
 }
 
+const std::vector<DecisionTree::Ptr>& RandomForest::get_trees() const
+{
+  std::call_once(forest_built_, [this]()
+  {
+    if (not forest_.empty()) return; // trained or loaded from JSON
+    for (int idx = 0; idx < flat_.get_ntrees(); ++idx)
+    {
+      forest_.push_back(flat_.get_tree(idx));
+    }
+  });
+  return forest_;
+}
+
 void RandomForest::to_json(json& forest) const
 {
-  for (const auto& tree : forest_)
+  for (const auto& tree : get_trees())
   {
     json tree_json;
     tree->to_json(tree_json);
@@ -91,7 +385,7 @@ void RandomForest::save(const std::string& filename) const
 void RandomForest::to_dot(const std::string& prefix) const
 {
   int idx = 1;
-  for (const auto& tree : forest_)
+  for (const auto& tree : get_trees())
   {
     std::string filename = prefix + std::to_string(idx) + ".dot";
     std::ofstream file(filename);
@@ -104,9 +398,109 @@ void RandomForest::to_dot(const std::string& prefix) const
   }
 }
 
+void RandomForest::to_cpp(const std::string& filename,
+    const std::string& name) const
+{
+  std::ofstream out(filename);
+  if (not out)
+  {
+    throw SelException(std::string("File ")+filename+" cannot be written");
+  }
+  out << std::setprecision(std::numeric_limits<double>::max_digits10);
+  int nattributes = 0;
+  for (const auto& tree : get_trees())
+  {
+    nattributes = std::max(nattributes, count_attributes(*tree));
+  }
+  const Dictionary& classes = flat_.get_classes();
+  const std::vector<DecisionTree::Ptr>& trees = get_trees();
+  out << "// Random forest of " << trees.size() << " trees.\n";
+  out << "//\n";
+  out << "// x holds the attributes of a record: numbers (NaN if missing) or\n";
+  out << "// codes of categories (any other value for other categories):\n";
+  for (int column = 0; column < nattributes; ++column)
+  {
+    const Dictionary& dictionary = flat_.get_dictionary(column);
+    if (dictionary.size() == 0) continue;
+    out << "//   x[" << column << "]:";
+    for (Code code = 0; code < dictionary.size(); ++code)
+    {
+      out << ' ' << code << '=' << dictionary.decode(code);
+    }
+    out << '\n';
+  }
+  out << "\n#include <cmath>\n\n";
+  out << "namespace " << name << "\n{\n\n";
+  out << "const int ntrees = " << trees.size() << ";\n";
+  out << "const int nclasses = " << classes.size() << ";\n";
+  out << "const int nattributes = " << nattributes << ";\n";
+  out << "const char* const classes[nclasses > 0? nclasses : 1] = {";
+  for (Code code = 0; code < classes.size(); ++code)
+  {
+    out << (code? ", " : "") << quote(classes.decode(code));
+  }
+  out << "};\n\n";
+  for (int idx = 0; idx < trees.size(); ++idx)
+  {
+    out << "static int tree_" << idx << "(const double* x)\n{\n";
+    tree_to_cpp(*trees[idx], flat_, 2, out);
+    out << "}\n\n";
+  }
+  out << "// Majority vote (ties go to the lowest index); votes may be null.\n";
+  out << "int classify(const double* x, int* votes)\n{\n";
+  out << "  int buffer[nclasses > 0? nclasses : 1] = {0};\n";
+  out << "  if (not votes) votes = buffer;\n";
+  out << "  else for (int c = 0; c < nclasses; ++c) votes[c] = 0;\n";
+  for (int idx = 0; idx < trees.size(); ++idx)
+  {
+    out << "  ++votes[tree_" << idx << "(x)];\n";
+  }
+  out << "  int best = 0;\n";
+  out << "  for (int c = 1; c < nclasses; ++c) if (votes[c] > votes[best]) best = c;\n";
+  out << "  return best;\n";
+  out << "}\n\n";
+  out << "}\n\n";
+  out << "#ifdef FOREST_MAIN\n\n";
+  out << "#include <chrono>\n#include <cstdlib>\n#include <cstring>\n";
+  out << "#include <iostream>\n#include <sstream>\n#include <vector>\n\n";
+  out << "// Reads one row per line of whitespace-separated values (nan for\n";
+  out << "// missing numbers) and prints their classes, or with --bench n\n";
+  out << "// classifies them n times and prints the throughput.\n";
+  out << "int main(int argc, char* argv[])\n{\n";
+  out << "  int repetitions = 0;\n";
+  out << "  if (argc == 3 and std::strcmp(argv[1], \"--bench\") == 0)\n";
+  out << "  {\n    repetitions = std::atoi(argv[2]);\n  }\n";
+  out << "  // One value per row at least, so that rows[row*width] exists.\n";
+  out << "  const long width = " << std::max(nattributes, 1) << ";\n";
+  out << "  std::vector<double> rows;\n";
+  out << "  std::string line, value;\n";
+  out << "  long nrows = 0;\n";
+  out << "  while (std::getline(std::cin, line))\n  {\n";
+  out << "    std::istringstream values(line);\n";
+  out << "    rows.resize((nrows + 1)*width);\n";
+  out << "    for (int column = 0; column < " << name <<
+    "::nattributes and values >> value; ++column)\n    {\n";
+  out << "      rows[nrows*width + column] = std::strtod(value.c_str(), nullptr);\n";
+  out << "    }\n    ++nrows;\n  }\n";
+  out << "  if (repetitions == 0)\n  {\n";
+  out << "    for (long row = 0; row < nrows; ++row)\n    {\n";
+  out << "      int guess = " << name << "::classify(&rows[row*width], nullptr);\n";
+  out << "      std::cout << " << name << "::classes[guess] << '\\n';\n";
+  out << "    }\n    return 0;\n  }\n";
+  out << "  long checksum = 0;\n";
+  out << "  auto start = std::chrono::steady_clock::now();\n";
+  out << "  for (int rep = 0; rep < repetitions; ++rep)\n  {\n";
+  out << "    for (long row = 0; row < nrows; ++row)\n    {\n";
+  out << "      checksum += " << name << "::classify(&rows[row*width], nullptr);\n";
+  out << "    }\n  }\n";
+  out << "  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;\n";
+  out << "  std::cout << (nrows*repetitions/elapsed.count()) << \" rows/s (checksum \" << checksum << \")\\n\";\n";
+  out << "}\n\n#endif\n";
+}
+
 void RandomForest::count_features(std::map<std::string,int>& counts) const
 {
-  for (const auto& tree : forest_)
+  for (const auto& tree : get_trees())
   {
     tree->count_features(counts);
   }
@@ -1,8 +1,11 @@
 #ifndef RANDOM_FOREST_H
 #define RANDOM_FOREST_H
 
+#include "flat_forest.h"
 #include "tree.h"
 
+#include <mutex>
+
 namespace sel
 {
 
@@ -14,9 +17,30 @@ class RandomForest
 
     typedef std::unique_ptr<RandomForest> Ptr;
 
+    /** 
+     * @brief Loads a forest saved in JSON or in binary format.
+     */
     static Ptr load(const std::string& filename);
 
-    RandomForest(const Dataframe& data, int ntrees, int f, int n, Metric m);
+    /** 
+     * @brief Trains a forest of ntrees trees.
+     *
+     * Each tree draws its random numbers from its own stream, split from rng
+     * by the index of the tree, so the resulting forest does not depend on
+     * the number of threads.
+     * 
+     * @param threads Number of trees trained concurrently (<= 0 means as
+     * many as hardware threads).
+     * @param rng Generator from which the streams of the trees are derived.
+     * @param bootstrap Whether each tree is trained with a bootstrap sample
+     * of data (a weighted View, so no record is copied) or with all of it.
+     * In the former case, each tree also votes for the records left out of
+     * its sample, yielding an out-of-bag estimate of the accuracy.
+     * @param search How to find the thresholds of numeric attributes.
+     */
+    RandomForest(const Dataframe& data, int ntrees, int f, int n, Metric m,
+        int threads=1, const Rng& rng=Rng(), bool bootstrap=true,
+        SplitSearch search=SplitSearch::exact);
 
     RandomForest(const RandomForest&) = delete;
 
@@ -26,19 +50,100 @@ class RandomForest
 
     void classify(const Dataframe& data, std::vector<std::string>& guesses) const;
 
+    /** 
+     * @brief Classifies the rows of a dense matrix, without building a
+     * Table (see FlatForest::classify).
+     */
+    void classify(const FeatureMatrix& matrix, Code* guesses,
+        int* votes=nullptr) const
+    {
+      flat_.classify(matrix, guesses, votes);
+    }
+
+    /** 
+     * @return Representation of the trees used to classify.
+     */
+    const FlatForest& get_flat() const { return flat_; }
+
+    /** 
+     * @return Classes, whose codes are written by classify(FeatureMatrix).
+     */
+    const Dictionary& get_classes() const { return flat_.get_classes(); }
+
+    /** 
+     * @return Codes of the categories of a nominal attribute in a
+     * FeatureMatrix.
+     */
+    const Dictionary& get_dictionary(int column) const
+    {
+      return flat_.get_dictionary(column);
+    }
+
     void to_json(json& forest) const;
 
     void save(const std::string& filename) const;
 
+    /** 
+     * @brief Saves the forest in binary format (see FlatForest::save),
+     * which load recognizes.
+     */
+    void save_binary(const std::string& filename) const { flat_.save(filename); }
+
     void to_dot(const std::string& prefix) const;
+
+    /** 
+     * @brief Writes a standalone C++ source file with each tree compiled to
+     * nested if/else statements.
+     *
+     * The file defines, in namespace name, classify(const double* x, int*
+     * votes), which takes the attributes of a record encoded like a row of
+     * a FeatureMatrix (missing numbers as NaN) and returns the index of its
+     * class in the array classes. Compiled with -DFOREST_MAIN, it also
+     * defines a main function that classifies the rows read from the
+     * standard input, or times them with "--bench repetitions".
+     */
+    void to_cpp(const std::string& filename,
+        const std::string& name="forest") const;
  
     void count_features(std::map<std::string,int>& counts) const;
 
+    /** 
+     * @return Trees of the forest. Those of a forest loaded from a binary
+     * file are only built from its nodes on the first call.
+     */
+    const std::vector<DecisionTree::Ptr>& get_trees() const;
+
+    /** 
+     * @return Out-of-bag votes received by each record of the training
+     * data, indexed by the Code of the class (empty if the forest was not
+     * trained with bootstrap samples).
+     */
+    const std::vector<CategoryFrequency>& get_oob_votes() const
+    {
+      return oob_votes_;
+    }
+
+    /** 
+     * @return Accuracy of the out-of-bag majority vote over the training
+     * records that have been left out of at least one sample (NaN if none).
+     */
+    double get_oob_accuracy() const { return oob_accuracy_; }
+
   private:
 
-    RandomForest() {}
+    RandomForest() : oob_accuracy_(std::numeric_limits<double>::quiet_NaN()) {}
+
+    void compute_oob_accuracy(const Dataframe& data);
 
-    std::vector<DecisionTree::Ptr> forest_;
+    /* Built lazily from flat_ if the forest was loaded from a binary
+     * file. */
+    mutable std::vector<DecisionTree::Ptr> forest_;
+    mutable std::once_flag forest_built_;
+    /* Compiled from forest_ (or mapped from a binary file), used to
+     * classify. */
+    FlatForest flat_;
+    std::vector<CategoryFrequency> oob_votes_;
+    double oob_accuracy_;
 
 };
 
@@ -0,0 +1,578 @@
+#include "imputation.h"
+#include "quick_scorer.h"
+#include "random_forest.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+
+#ifndef DATA_PATH
+#define DATA_PATH "../Data/"
+#endif
+
+namespace
+{
+
+/* Majority vote of the trees of forest, each one traversed node by node with
+ * DecisionTree::classify, for each record of data (ties go to the lowest
+ * class in lexicographic order, like in FlatForest). */
+void majority_vote(const sel::RandomForest& forest, const sel::Dataframe& data,
+    std::vector<std::string>& guesses)
+{
+  guesses.clear();
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    const sel::Instance instance = data.get_instance(idx);
+    std::map<std::string,int> votes;
+    for (const auto& tree : forest.get_trees()) ++votes[tree->classify(instance)];
+    std::string best;
+    int most = 0;
+    for (const auto& vote : votes)
+    {
+      if (vote.second > most)
+      {
+        best = vote.first;
+        most = vote.second;
+      }
+    }
+    guesses.push_back(best);
+  }
+}
+
+/* Attributes of the records of data as the values of a FeatureMatrix for
+ * forest: numbers, or codes of the categories in the dictionaries of forest.
+ * Missing values are flagged in missing if it is not null (their value is
+ * then 0), or else encoded as NaN or as the code of "?". */
+sel::FeatureMatrix encode(const sel::RandomForest& forest,
+    const sel::Dataframe& data, sel::MatrixLayout layout,
+    std::vector<double>& values, std::vector<std::uint8_t>* missing)
+{
+  sel::FeatureMatrix matrix = {nullptr, data.get_nrecords(),
+    data.get_nattributes(), layout, nullptr};
+  long size = (long)matrix.nrows*matrix.ncolumns;
+  values.assign(size, 0);
+  if (missing) missing->assign(size, 0);
+  for (int row = 0; row < matrix.nrows; ++row)
+  {
+    const sel::Instance instance = data.get_instance(row);
+    for (int column = 0; column < matrix.ncolumns; ++column)
+    {
+      long offset = layout == sel::MatrixLayout::row_major?
+        (long)row*matrix.ncolumns + column :
+        (long)column*matrix.nrows + row;
+      bool numeric = data.get_attribute(column).numeric;
+      if (instance.is_missing(column) and missing) (*missing)[offset] = 1;
+      else if (numeric) values[offset] = instance.get_number(column);
+      else
+      {
+        values[offset] = forest.get_dictionary(column).find(
+            instance.get_category(column));
+      }
+    }
+  }
+  matrix.values = values.data();
+  if (missing) matrix.missing = missing->data();
+  return matrix;
+}
+
+/* Whether the guesses (codes of the classes of forest) are the expected
+ * classes. */
+bool same_classes(const sel::RandomForest& forest,
+    const std::vector<sel::Code>& guesses,
+    const std::vector<std::string>& expected)
+{
+  if (guesses.size() != expected.size()) return false;
+  for (int idx = 0; idx < guesses.size(); ++idx)
+  {
+    if (forest.get_classes().decode(guesses[idx]) != expected[idx])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char* yes_no(bool value)
+{
+  return value? "yes" : "no";
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " datasetname\n";
+    return -1;
+  }
+  try
+  {
+    std::string datafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".data";
+    std::string metafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".meta";
+
+    sel::Table table(datafile, metafile);
+    sel::Rng rng(42);
+    table.shuffle(rng);
+
+    /* The forest is trained on a copy without missing values, and the
+     * records it classifies keep them. */
+    sel::Table train(table);
+    sel::PerClass<sel::MedianModeImputation> imp(train);
+    imp(train);
+    sel::RandomForest forest(train, 10, -1, 2, sel::gini, 1, rng);
+    std::vector<std::string> expected;
+    majority_vote(forest, table, expected);
+
+    bool ok = true;
+    std::vector<std::string> guesses;
+    forest.classify(table, guesses);
+    bool same = guesses == expected;
+    std::cout << "Flat forest matches the trees: " << yes_no(same) << '\n';
+    ok = ok and same;
+    const sel::FlatForest& flat = forest.get_flat();
+    std::vector<int> votes;
+    same = true;
+    for (int idx = 0; idx < table.get_nrecords(); ++idx)
+    {
+      sel::Code guess = flat.classify(table.get_instance(idx), votes);
+      same = same and flat.get_classes().decode(guess) == expected[idx];
+    }
+    std::cout << "Flat forest matches the trees record by record: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* Feature matrices in both layouts, with missing values encoded in the
+     * values or flagged in a mask. */
+    std::vector<double> values;
+    std::vector<std::uint8_t> missing;
+    std::vector<sel::Code> codes(table.get_nrecords());
+    int nclasses = forest.get_classes().size();
+    std::vector<int> matrix_votes(table.get_nrecords()*nclasses);
+    const sel::MatrixLayout layouts[] = {sel::MatrixLayout::row_major,
+      sel::MatrixLayout::column_major};
+    for (sel::MatrixLayout layout : layouts)
+    {
+      const char* name = layout == sel::MatrixLayout::row_major?
+        "Row-major" : "Column-major";
+      sel::FeatureMatrix matrix = encode(forest, table, layout, values,
+          nullptr);
+      forest.classify(matrix, codes.data(), matrix_votes.data());
+      same = same_classes(forest, codes, expected);
+      for (int idx = 0; same and idx < table.get_nrecords(); ++idx)
+      {
+        flat.classify(table.get_instance(idx), votes);
+        same = std::equal(votes.begin(), votes.end(),
+            matrix_votes.begin() + idx*nclasses);
+      }
+      std::cout << name << " matrix matches the trees (votes included): "
+        << yes_no(same) << '\n';
+      ok = ok and same;
+      matrix = encode(forest, table, layout, values, &missing);
+      forest.classify(matrix, codes.data());
+      same = same_classes(forest, codes, expected);
+      std::cout << name << " matrix with a missing mask matches the trees: "
+        << yes_no(same) << '\n';
+      ok = ok and same;
+    }
+
+    /* Without a mask, trees without categorical nodes are traversed eight
+     * rows at a time (with AVX2 if the CPU supports it), and a mask without
+     * missing values forces the traversal of one row at a time. Both are
+     * compared for several numbers of rows, with some numbers replaced by
+     * NaN. */
+    sel::FeatureMatrix matrix = encode(forest, table,
+        sel::MatrixLayout::row_major, values, nullptr);
+    for (long offset = 0; offset < values.size(); offset += 7)
+    {
+      if (table.get_attribute(offset%matrix.ncolumns).numeric)
+      {
+        values[offset] = std::numeric_limits<double>::quiet_NaN();
+      }
+    }
+    std::vector<std::uint8_t> no_missing(values.size(), 0);
+    sel::FeatureMatrix masked = matrix;
+    masked.missing = no_missing.data();
+    std::vector<int> masked_votes(matrix_votes.size());
+    std::vector<int> sizes = {1, 7, 8, 9, 15, 16, 17, table.get_nrecords()};
+    same = true;
+    for (int nrows : sizes)
+    {
+      matrix.nrows = masked.nrows = std::min(nrows, table.get_nrecords());
+      forest.classify(matrix, codes.data(), matrix_votes.data());
+      forest.classify(masked, codes.data(), masked_votes.data());
+      same = same and std::equal(masked_votes.begin(),
+          masked_votes.begin() + matrix.nrows*nclasses, matrix_votes.begin());
+    }
+    std::cout << "Vectorized traversal matches the scalar one: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* Trees split into several tiles (down to a tree each) give the votes
+     * of a single tile, for records and for the matrix above. */
+    sel::FlatForest tiled(flat);
+    tiled.set_tile_bytes(std::numeric_limits<long>::max());
+    std::vector<int> single_votes(matrix_votes.size());
+    std::vector<int> single_matrix_votes(matrix_votes.size());
+    tiled.classify(table, codes, single_votes.data());
+    tiled.classify(matrix, codes.data(), single_matrix_votes.data());
+    same = tiled.get_ntiles() == 1;
+    for (long bytes : {4096L, 1L})
+    {
+      tiled.set_tile_bytes(bytes);
+      tiled.classify(table, codes, masked_votes.data());
+      same = same and masked_votes == single_votes;
+      tiled.classify(matrix, codes.data(), masked_votes.data());
+      same = same and masked_votes == single_matrix_votes;
+    }
+    same = same and tiled.get_ntiles() == tiled.get_ntrees();
+    std::cout << "Tiled classification matches a single tile: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* QuickScorer, on the forest above (with trees that may have more
+     * leaves than its bitvectors hold) and on a forest of small trees. */
+    sel::RandomForest small(train, 10, -1, train.get_nrecords()/8, sel::gini,
+        1, rng);
+    const sel::RandomForest* forests[] = {&forest, &small};
+    for (const sel::RandomForest* scored : forests)
+    {
+      std::vector<std::string> scored_expected;
+      majority_vote(*scored, table, scored_expected);
+      sel::QuickScorer scorer(*scored);
+      scorer.classify(table, codes);
+      same = same_classes(*scored, codes, scored_expected);
+      matrix = encode(*scored, table, sel::MatrixLayout::row_major, values,
+          &missing);
+      int scored_nclasses = scored->get_classes().size();
+      std::vector<int> scorer_votes(table.get_nrecords()*scored_nclasses);
+      std::vector<int> flat_votes(scorer_votes.size());
+      scorer.classify(matrix, codes.data(), scorer_votes.data());
+      scored->classify(matrix, codes.data(), flat_votes.data());
+      same = same and same_classes(*scored, codes, scored_expected) and
+        scorer_votes == flat_votes;
+      std::cout << "QuickScorer matches the trees ("
+        << (scored == &forest? "default" : "small") << " trees): "
+        << yes_no(same) << '\n';
+      ok = ok and same;
+    }
+
+    /* The exported C++ source, built with its driver, classifies the rows
+     * of the matrix (written to the working directory and removed at the
+     * end). */
+    std::string prefix = std::string(argv[1]) + "_forest";
+    forest.to_cpp(prefix + ".cpp");
+    matrix = encode(forest, table, sel::MatrixLayout::row_major, values,
+        nullptr);
+    {
+      std::ofstream rows(prefix + ".in");
+      rows << std::setprecision(std::numeric_limits<double>::max_digits10);
+      for (int row = 0; row < matrix.nrows; ++row)
+      {
+        for (int column = 0; column < matrix.ncolumns; ++column)
+        {
+          rows << values[(long)row*matrix.ncolumns + column] << ' ';
+        }
+        rows << '\n';
+      }
+    }
+    std::string command = "g++ -DFOREST_MAIN " + prefix + ".cpp -o " +
+      prefix + " && ./" + prefix + " < " + prefix + ".in > " + prefix + ".out";
+    same = std::system(command.c_str()) == 0;
+    {
+      std::ifstream classes(prefix + ".out");
+      std::string line;
+      for (int idx = 0; same and idx < expected.size(); ++idx)
+      {
+        same = std::getline(classes, line) and line == expected[idx];
+      }
+    }
+    std::cout << "Exported C++ source matches the trees: " << yes_no(same)
+      << '\n';
+    ok = ok and same;
+    for (const char* extension : {".cpp", ".in", ".out", ""})
+    {
+      std::remove((prefix + extension).c_str());
+    }
+    /* Trees that are single leaves test no attribute, so the driver reads
+     * empty rows (one per line; bounds are checked by the standard
+     * library). */
+    sel::RandomForest leaves(train, 3, -1, train.get_nrecords() + 1,
+        sel::gini, 1, rng);
+    std::vector<std::string> leaves_expected;
+    majority_vote(leaves, table, leaves_expected);
+    leaves.to_cpp(prefix + ".cpp");
+    {
+      std::ofstream rows(prefix + ".in");
+      for (int row = 0; row < table.get_nrecords(); ++row) rows << '\n';
+    }
+    command = "g++ -Wall -Werror -D_GLIBCXX_ASSERTIONS -DFOREST_MAIN " + prefix + ".cpp -o " +
+      prefix + " && ./" + prefix + " < " + prefix + ".in > " + prefix + ".out";
+    same = std::system(command.c_str()) == 0;
+    {
+      std::ifstream classes(prefix + ".out");
+      std::string line;
+      for (int idx = 0; same and idx < leaves_expected.size(); ++idx)
+      {
+        same = std::getline(classes, line) and line == leaves_expected[idx];
+      }
+    }
+    std::cout << "Exported C++ source of single-leaf trees matches them: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+    for (const char* extension : {".cpp", ".in", ".out", ""})
+    {
+      std::remove((prefix + extension).c_str());
+    }
+
+    /* Forest saved in binary format and mapped back, and its trees rebuilt
+     * from the mapped nodes. */
+    std::string binary = std::string(argv[1]) + "_forest.bin";
+    forest.save_binary(binary);
+    sel::RandomForest::Ptr loaded = sel::RandomForest::load(binary);
+    loaded->classify(table, guesses);
+    same = guesses == expected;
+    matrix = encode(*loaded, table, sel::MatrixLayout::row_major, values,
+        &missing);
+    loaded->classify(matrix, codes.data());
+    same = same and same_classes(*loaded, codes, expected);
+    std::vector<std::string> rebuilt;
+    majority_vote(*loaded, table, rebuilt);
+    same = same and rebuilt == expected;
+    std::cout << "Forest mapped from a binary file matches the trees: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+    /* A truncated file is rejected. */
+    std::string truncated = binary + ".truncated";
+    {
+      std::ifstream in(binary, std::ios::binary);
+      std::string bytes((std::istreambuf_iterator<char>(in)),
+          std::istreambuf_iterator<char>());
+      std::ofstream out(truncated, std::ios::binary);
+      out.write(bytes.data(), bytes.size()/2);
+    }
+    bool rejected = false;
+    try
+    {
+      sel::RandomForest::load(truncated);
+    }
+    catch (sel::SelException&)
+    {
+      rejected = true;
+    }
+    std::cout << "Truncated binary file rejected: " << yes_no(rejected)
+      << '\n';
+    ok = ok and rejected;
+    std::remove(binary.c_str());
+    std::remove(truncated.c_str());
+
+    /* The same records read with every attribute nominal: the forest
+     * rejects them if it tests a numeric attribute, and otherwise matches
+     * their categories by name. */
+    std::string nominal_meta = std::string(argv[1]) + "_nominal.meta";
+    {
+      std::ofstream out(nominal_meta);
+      out << table.get_nattributes() << '\n';
+      for (int column = 0; column < table.get_nattributes(); ++column)
+      {
+        out << "Nominal " << table.get_attribute(column).name << '\n';
+      }
+      out << table.get_target_name() << '\n';
+    }
+    sel::Table nominal(datafile, nominal_meta);
+    std::remove(nominal_meta.c_str());
+    bool numeric = false;
+    for (int column = 0; column < table.get_nattributes(); ++column)
+    {
+      numeric = numeric or table.get_attribute(column).numeric;
+    }
+    if (numeric)
+    {
+      rejected = false;
+      try
+      {
+        forest.classify(nominal, guesses);
+      }
+      catch (sel::SelException&)
+      {
+        rejected = true;
+      }
+      std::cout << "Numeric attributes read as nominal rejected: "
+        << yes_no(rejected) << '\n';
+      ok = ok and rejected;
+      rejected = false;
+      try
+      {
+        sel::QuickScorer(forest).classify(nominal, codes);
+      }
+      catch (sel::SelException&)
+      {
+        rejected = true;
+      }
+      std::cout << "Numeric attributes read as nominal rejected by "
+        "QuickScorer: " << yes_no(rejected) << '\n';
+      ok = ok and rejected;
+    }
+    else
+    {
+      std::vector<std::string> reread;
+      majority_vote(forest, nominal, reread);
+      forest.classify(nominal, guesses);
+      sel::QuickScorer(forest).classify(nominal, codes);
+      same = guesses == reread and same_classes(forest, codes, reread);
+      std::cout << "Flat forest matches the trees on a reread table: "
+        << yes_no(same) << '\n';
+      ok = ok and same;
+    }
+
+    /* Forest saved in JSON format and loaded back without a document: its
+     * trees are those of the parsed document (thresholds are saved with 15
+     * digits, so they may differ from those of forest). */
+    std::string json_file = std::string(argv[1]) + "_forest.json";
+    forest.save(json_file);
+    loaded = sel::RandomForest::load(json_file);
+    sel::json document, loaded_json;
+    std::ifstream(json_file) >> document;
+    loaded->to_json(loaded_json);
+    loaded->classify(table, guesses);
+    std::vector<std::string> loaded_expected;
+    majority_vote(*loaded, table, loaded_expected);
+    same = loaded_json == document and guesses == loaded_expected;
+    std::cout << "Forest loaded from a JSON file matches its document: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+    {
+      std::ifstream in(json_file);
+      std::string text((std::istreambuf_iterator<char>(in)),
+          std::istreambuf_iterator<char>());
+      std::ofstream out(truncated);
+      out << text.substr(0, text.size()/2);
+    }
+    rejected = false;
+    try
+    {
+      sel::RandomForest::load(truncated);
+    }
+    catch (sel::SelException&)
+    {
+      rejected = true;
+    }
+    std::cout << "Truncated JSON file rejected: " << yes_no(rejected) << '\n';
+    ok = ok and rejected;
+    std::remove(json_file.c_str());
+    std::remove(truncated.c_str());
+
+    /* A bootstrap sample expressed as row weights weighs the records like
+     * a view with the drawn rows, repeated. */
+    std::vector<double> counts(train.get_nrecords(), 0);
+    std::vector<int> drawn;
+    for (int idx = 0; idx < train.get_nrecords(); ++idx)
+    {
+      int row = rng.uniform(train.get_nrecords());
+      counts[row] += 1;
+      drawn.push_back(row);
+    }
+    sel::View weighted(train, std::vector<double>(counts));
+    sel::View copies(train, std::move(drawn));
+    sel::CategoryFrequency weighted_freq, copies_freq;
+    weighted.category_freq(train.get_target_idx(), weighted_freq, false);
+    copies.category_freq(train.get_target_idx(), copies_freq, false);
+    same = weighted_freq == copies_freq;
+    for (int column = 0; column < train.get_nattributes(); ++column)
+    {
+      if (column == train.get_target_idx()) continue;
+      if (train.get_attribute(column).numeric)
+      {
+        sel::NumericDecisionStump a(weighted, column, sel::GiniCriterion());
+        sel::NumericDecisionStump b(copies, column, sel::GiniCriterion());
+        same = same and a.get_m() == b.get_m() and
+          (a.get_m() == sel::inf or a.get_threshold() == b.get_threshold());
+      }
+      else
+      {
+        sel::CategoricalDecisionStump a(weighted, column, sel::GiniCriterion());
+        sel::CategoricalDecisionStump b(copies, column, sel::GiniCriterion());
+        same = same and a.get_m() == b.get_m() and
+          (a.get_m() == sel::inf or a.get_to_left() == b.get_to_left());
+      }
+    }
+    std::cout << "Bootstrap weights split like repeated records: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* Out-of-bag votes of the forest, recomputed from the samples of its
+     * trees (each drawn first from the stream rng.split(tree)), and the
+     * accuracy of their majority. */
+    const sel::Dictionary& classes =
+      train.get_column(train.get_target_idx()).dictionary;
+    std::vector<sel::CategoryFrequency> oob_votes(train.get_nrecords(),
+        sel::CategoryFrequency(classes.size(), 0));
+    for (int tree = 0; tree < forest.get_trees().size(); ++tree)
+    {
+      sel::Rng tree_rng = rng.split(tree);
+      std::vector<double> sample(train.get_nrecords(), 0);
+      for (int idx = 0; idx < train.get_nrecords(); ++idx)
+      {
+        sample[tree_rng.uniform(train.get_nrecords())] += 1;
+      }
+      for (int idx = 0; idx < train.get_nrecords(); ++idx)
+      {
+        if (sample[idx] > 0) continue;
+        std::string guess = forest.get_trees()[tree]->classify(
+            train.get_instance(idx));
+        oob_votes[idx][classes.find(guess)] += 1;
+      }
+    }
+    int hits = 0, total = 0;
+    for (int idx = 0; idx < train.get_nrecords(); ++idx)
+    {
+      const sel::CategoryFrequency& votes = oob_votes[idx];
+      auto most_voted = std::max_element(votes.begin(), votes.end());
+      if (*most_voted == 0) continue;
+      sel::Code guess = most_voted - votes.begin();
+      if (guess == train.get_instance(idx).get_code(train.get_target_idx()))
+      {
+        ++hits;
+      }
+      ++total;
+    }
+    same = forest.get_oob_votes() == oob_votes and total > 0 and
+      forest.get_oob_accuracy() == hits/(double)total;
+    std::cout << "Out-of-bag votes and accuracy match the samples: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+    sel::RandomForest whole(train, 2, -1, 2, sel::gini, 1, rng, false);
+    same = whole.get_oob_votes().empty() and
+      std::isnan(whole.get_oob_accuracy());
+    std::cout << "No out-of-bag estimate without bootstrap: " << yes_no(same)
+      << '\n';
+    ok = ok and same;
+
+    /* The same seed gives the same forest and out-of-bag votes whatever
+     * the number of threads that train the trees. */
+    sel::RandomForest sequential(train, 16, -1, 2, sel::gini, 1, sel::Rng(7));
+    sel::RandomForest concurrent(train, 16, -1, 2, sel::gini, 4, sel::Rng(7));
+    sel::json sequential_json, concurrent_json;
+    sequential.to_json(sequential_json);
+    concurrent.to_json(concurrent_json);
+    same = sequential_json == concurrent_json and
+      sequential.get_oob_votes() == concurrent.get_oob_votes();
+    std::cout << "Forest trained on 4 threads matches the one trained on 1: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    if (not ok) return 1;
+  }
+  catch (sel::SelException& ex)
+  {
+    std::cerr << ex.what() << '\n';
+    return 1;
+  }
+}
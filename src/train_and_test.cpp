@@ -1,10 +1,13 @@
 #include "args.hxx"
 #include "imputation.h"
+#include "quick_scorer.h"
 #include "random_forest.h"
 
+#include <chrono>
 #include <ctime>
 #include <cstdlib>
 #include <iostream>
+#include <numeric>
 
 #ifndef DATA_PATH
 #define DATA_PATH "../Data/"
@@ -12,17 +15,19 @@
 
 struct Options
 {
-  bool train;
-  std::string load, save, dot_prefix, dataset;
-  int verbose, ntrees, f, n, cv, rng;
+  bool train, bootstrap, quickscorer, cache;
+  std::string load, save, dot_prefix, cpp, binary, columnar, dataset;
+  int verbose, ntrees, f, n, cv, rng, threads;
   sel::Metric metric;
+  sel::SplitSearch search;
 };
 
 Options parse_argv(int argc, char* argv[]);
 
 void print_options(const Options& options);
 
-double evaluate_forest(const sel::RandomForest& forest, const sel::Dataframe& test);
+double evaluate_forest(const sel::RandomForest& forest, const sel::Dataframe& test,
+    bool quickscorer);
 
 void rank_features(const sel::RandomForest& forest);
 
@@ -33,7 +38,6 @@ double stdev(const std::vector<double>& v);
 int main(int argc, char* argv[])
 {
   Options options = parse_argv(argc, argv);
-  srand(options.rng);
   if (options.verbose >= 3) print_options(options);
   
   std::string datafile = std::string(DATA_PATH)+options.dataset+'/'+options.dataset+".data";
@@ -41,10 +45,29 @@ int main(int argc, char* argv[])
 
   try
   {
-    sel::Table table(datafile, metafile);
+    if (options.cache) sel::Table::update_cache(datafile, metafile);
+    if (not options.columnar.empty())
+    {
+      sel::Table::convert(datafile, metafile, options.columnar);
+    }
+    sel::Table table = options.columnar.empty()?
+      sel::Table(datafile, metafile, options.threads) :
+      sel::Table::map(options.columnar);
     if (options.verbose >= 2) std::cout << table << std::endl;
 
-    table.shuffle();
+    sel::Rng rng(options.rng);
+    /* Records in shuffled order. A mapped table is not shuffled itself, which
+     * would copy all its columns into memory, but gets the same order. */
+    std::vector<int> order(table.get_nrecords());
+    std::iota(order.begin(), order.end(), 0);
+    if (options.columnar.empty()) table.shuffle(rng);
+    else
+    {
+      for (int idx = (int)order.size()-1; idx > 0; --idx)
+      {
+        std::swap(order[idx], order[rng.uniform(idx+1)]);
+      }
+    }
 
     bool has_missing = table.get_nmissing() > 0;
 
@@ -65,8 +88,9 @@ int main(int argc, char* argv[])
         {
           if (options.verbose >= 1) std::cout << "Fold " << (fold+1) << ": ";
           sel::Table copy(table);
-          sel::View train(copy, fold*fold_size, (fold+1)*fold_size, true);
-          sel::View test(copy, fold*fold_size, (fold+1)*fold_size);
+          sel::View records(copy, std::vector<int>(order));
+          sel::View train(records, fold*fold_size, (fold+1)*fold_size, true);
+          sel::View test(records, fold*fold_size, (fold+1)*fold_size);
           if (has_missing)
           {
             sel::PerClass<sel::MedianModeImputation> imp1(train);
@@ -75,14 +99,19 @@ int main(int argc, char* argv[])
             imp2(test);
           }
           std::clock_t start = std::clock();
+          auto wall_start = std::chrono::steady_clock::now();
           sel::RandomForest::Ptr forest(new sel::RandomForest(
-                train, options.ntrees, options.f, options.n, options.metric));
+                train, options.ntrees, options.f, options.n, options.metric,
+                options.threads, rng, options.bootstrap, options.search));
           elapsed[fold] = (std::clock() - start)/(double)CLOCKS_PER_SEC;
-          accuracies[fold] = evaluate_forest(*forest, test);
+          std::chrono::duration<double> wall =
+            std::chrono::steady_clock::now() - wall_start;
+          accuracies[fold] = evaluate_forest(*forest, test, options.quickscorer);
           if (options.verbose >= 1)
           {
             std::cout << "accuracy = " << (accuracies[fold]*100)
-                      << "%; elapsed(CPU) = " << elapsed[fold] << "s" << std::endl;
+                      << "%; elapsed(CPU) = " << elapsed[fold] << "s"
+                      << "; elapsed(wall) = " << wall.count() << "s" << std::endl;
           }
         }
         double avgacc = mean(accuracies);
@@ -97,14 +126,21 @@ int main(int argc, char* argv[])
       }
       else
       {
+        sel::View records(table, std::vector<int>(order));
         if (has_missing)
         {
           if (options.verbose >= 2) std::cout << "Data set has missing values. Using per-class median/mode imputation..." << std::endl;
-          sel::PerClass<sel::MedianModeImputation> imp(table);
-          imp(table);
+          sel::PerClass<sel::MedianModeImputation> imp(records);
+          imp(records);
         }
         sel::RandomForest::Ptr forest(new sel::RandomForest(
-              table, options.ntrees, options.f, options.n, options.metric));
+              records, options.ntrees, options.f, options.n, options.metric,
+              options.threads, rng, options.bootstrap, options.search));
+        if (options.verbose >= 2 and options.bootstrap)
+        {
+          std::cout << "OOB accuracy: " << (forest->get_oob_accuracy()*100)
+                    << "%" << std::endl;
+        }
         if (not options.save.empty())
         {
           forest->save(options.save);
@@ -113,6 +149,14 @@ int main(int argc, char* argv[])
         {
           forest->to_dot(options.dot_prefix);
         }
+        if (not options.cpp.empty())
+        {
+          forest->to_cpp(options.cpp);
+        }
+        if (not options.binary.empty())
+        {
+          forest->save_binary(options.binary);
+        }
         if (options.verbose >= 1) rank_features(*forest);
       }
     }
@@ -125,7 +169,8 @@ int main(int argc, char* argv[])
       }
       if (options.verbose >= 2) std::cout << "Loading tree from JSON..." << std::endl;
       auto forest = sel::RandomForest::load(options.load);
-      double acc = evaluate_forest(*forest, table);
+      if (not options.binary.empty()) forest->save_binary(options.binary);
+      double acc = evaluate_forest(*forest, table, options.quickscorer);
       if (options.verbose >= 1) std::cout << "Accuracy: " << (acc*100) << "%" << std::endl;
     }
   }
@@ -141,8 +186,13 @@ Options parse_argv(int argc, char* argv[])
   args::ArgumentParser parser("Train and/or test a random forest with an arbitrary data set");
   args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
   args::ValueFlag<int> verbose(parser, "verbose_level", "0: no info, 1: elapsed train time, accuracy and feature weights, if applicable (default); 2: stats; 3+: options", {'v', "verbose"}); 
-  args::ValueFlag<int> rng(parser, "seed", "RNG seed", {'v', "verbose"}); 
-  args::ValueFlag<std::string> load(parser, "filename", "Load forest from JSON, instead of training from scratch", {'l', "load"});
+  args::ValueFlag<int> rng(parser, "seed", "RNG seed (default 42)", {'s', "seed"}); 
+  args::ValueFlag<std::string> load(parser, "filename", "Load forest (JSON or binary), instead of training from scratch", {'l', "load"});
+  args::ValueFlag<std::string> binary(parser, "filename", "Store forest in binary format (also after --load, to convert a JSON forest)", {'b', "binary"});
+  args::ValueFlag<int> threads(parser, "threads", "Number of threads that parse the data set and train trees (default 1, <= 0 means one per hardware thread)", {'t', "threads"});
+  args::ValueFlag<std::string> columnar(parser, "filename", "Convert the data set into a columnar file and use it mapped into memory, for data sets that do not fit in memory", {'c', "columnar"});
+  args::Flag cache(parser, "cache", "Convert the data set into a binary cache next to it (.rfdata) if it is missing or outdated. The cache is loaded instead of the data set while it is up to date", {"cache"});
+  args::Flag quickscorer(parser, "quickscorer", "Classify with the QuickScorer engine (trees of more than 64 leaves are traversed)", {'Q', "quickscorer"});
   args::Group train(parser, "Train parameters", args::Group::Validators::DontCare);
   args::ValueFlag<int> ntrees(train, "ntrees", "Number of trees in the ensemble (default 10)", {'M', "ntrees"});
   args::ValueFlag<int> f(train, "f", "Number of features evaluated randomly at each split (sqrt of the number of attributes if not specified)", {'F', "feature-bag"});
@@ -151,16 +201,27 @@ Options parse_argv(int argc, char* argv[])
   args::Flag gini(metric, "gini", "Gini impurity (default)", {'g', "gini"});
   args::Flag entropy(metric, "entropy", "Entropy (information gain)", {'i', "entropy"});
   args::Flag error(metric, "error", "Error (1 - pmax)", {'e', "error"});
+  args::Group search(train, "Split search (numeric attributes)", args::Group::Validators::AtMostOne);
+  args::Flag exact(search, "exact", "Sort the records of each node (default)", {"exact"});
+  args::Flag presorted(search, "presorted", "Sort the records once and keep their order when splitting", {"presorted"});
+  args::Flag histogram(search, "histogram", "Quantize the attributes into 256 bins and split at bin boundaries", {"histogram"});
+  args::Flag no_bootstrap(train, "no-bootstrap", "Train every tree with the whole training set instead of a bootstrap sample", {"no-bootstrap"});
   args::ValueFlag<int> cv(train, "cv", "Cross validation (by default, no cross validation is performed)", {"cv"});
   args::ValueFlag<std::string> json(train, "filename", "Store forest in JSON format", {'j', "json"});
   args::ValueFlag<std::string> dot(train, "prefix", "Create dot files", {'d', "dot"});
+  args::ValueFlag<std::string> cpp(train, "filename", "Store forest as C++ source (compile with -DFOREST_MAIN for a driver)", {'C', "cpp"});
   args::Positional<std::string> dataset(parser, "datasetname", "Name of the data set (default iris).");
-  Options options = {true, "", "", "", "iris", 1, 10, -1, 2, 0, 42, sel::gini};
+  Options options = {true, true, false, false, "", "", "", "", "", "", "iris", 1, 10, -1, 2, 0, 42, 1, sel::gini, sel::SplitSearch::exact};
   try
   {
     parser.ParseCLI(argc, argv);
     if (verbose) options.verbose = args::get(verbose);
     if (rng) options.rng = args::get(rng);
+    if (threads) options.threads = args::get(threads);
+    if (quickscorer) options.quickscorer = true;
+    if (cache) options.cache = true;
+    if (binary) options.binary = args::get(binary);
+    if (columnar) options.columnar = args::get(columnar);
     if (load)
     {
       options.load = args::get(load);
@@ -174,24 +235,29 @@ Options parse_argv(int argc, char* argv[])
       if (gini) options.metric = sel::gini;
       else if (entropy) options.metric = sel::entropy;
       else if (error) options.metric = sel::error;
+      if (exact) options.search = sel::SplitSearch::exact;
+      else if (presorted) options.search = sel::SplitSearch::presorted;
+      else if (histogram) options.search = sel::SplitSearch::histogram;
+      if (no_bootstrap) options.bootstrap = false;
       if (cv) options.cv = args::get(cv);
       if (json) options.save = args::get(json);
       if (dot) options.dot_prefix = args::get(dot);
+      if (cpp) options.cpp = args::get(cpp);
     }
     if (dataset) options.dataset = args::get(dataset);
   }
-  catch (args::Help)
+  catch (args::Help&)
   {
     std::cout << parser;
     std::exit(0);
   }
-  catch (args::ParseError e)
+  catch (args::ParseError& e)
   {
     std::cerr << e.what() << std::endl;
     std::cerr << parser;
     std::exit(1);
   }
-  catch (args::ValidationError e)
+  catch (args::ValidationError& e)
   {
     std::cerr << e.what() << std::endl;
     std::cerr << parser;
@@ -204,6 +270,8 @@ void print_options(const Options& options)
 {
   std::cout << "Verbose: " << options.verbose << std::endl;
   std::cout << "Train: " << (options.train? "true" : "false") << std::endl;
+  std::cout << "QuickScorer: " << (options.quickscorer? "true" : "false") << std::endl;
+  std::cout << "Cache: " << (options.cache? "true" : "false") << std::endl;
   if (options.train)
   {
     std::string metric;
@@ -214,27 +282,45 @@ void print_options(const Options& options)
     std::cout << "f (<= 0 means sqrt of #attributes): " << options.f << std::endl;
     std::cout << "n: " << options.n << std::endl;
     std::cout << "Metric: " << metric << std::endl;
+    std::string search;
+    if (options.search == sel::SplitSearch::exact) search = "exact";
+    else if (options.search == sel::SplitSearch::presorted) search = "presorted";
+    else search = "histogram";
+    std::cout << "Split search: " << search << std::endl;
+    std::cout << "bootstrap: " << (options.bootstrap? "true" : "false") << std::endl;
+    std::cout << "threads: " << options.threads << std::endl;
     std::cout << "cv: " << options.cv << std::endl;
     std::cout << "save to json: " << options.save << std::endl;
     std::cout << "dot prefix: " << options.dot_prefix << std::endl;
+    std::cout << "save to C++: " << options.cpp << std::endl;
     std::cout << "rng seed: " << options.rng << std::endl;
   }
   else
   {
-    std::cout << "load from json: " << options.load << std::endl;
+    std::cout << "load from: " << options.load << std::endl;
   }
+  std::cout << "save to binary: " << options.binary << std::endl;
+  std::cout << "columnar file: " << options.columnar << std::endl;
   std::cout << "data set: " << options.dataset << std::endl;
 }
 
-double evaluate_forest(const sel::RandomForest& forest, const sel::Dataframe& test)
+double evaluate_forest(const sel::RandomForest& forest, const sel::Dataframe& test,
+    bool quickscorer)
 {
   double acc = 0;
   std::vector<std::string> guesses;
-  forest.classify(test, guesses);
+  if (quickscorer)
+  {
+    sel::QuickScorer scorer(forest);
+    std::vector<sel::Code> codes;
+    scorer.classify(test, codes);
+    for (sel::Code code : codes) guesses.push_back(scorer.get_classes().decode(code));
+  }
+  else forest.classify(test, guesses);
   int target_idx = test.get_target_idx();
   for (int idx = 0; idx < test.get_nrecords(); ++idx)
   {
-    std::string truth = test.get_instance(idx).get(target_idx).get_category();
+    const std::string& truth = test.get_instance(idx).get_category(target_idx);
     if (truth == guesses[idx]) acc += 1;
   }
   acc /= test.get_nrecords();
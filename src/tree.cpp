@@ -1,6 +1,6 @@
 #include "tree.h"
 
-//#include <iostream>
+#include <algorithm>
 
 namespace sel
 {
@@ -8,31 +8,94 @@ namespace sel
 namespace /* utils for internal usage */
 {
 
-void normalize(const CategoryFrequency& counts, CategoryFrequency& density)
+/* Class counts of the records on one side of a split, with the running sums
+ * of Criterion, which evaluate the impurity in constant time (error needs the
+ * largest count) as records move from one side to the other. */
+template <class Criterion>
+class Side
 {
-  double sum = 0;
-  density = counts;
-  for (const auto& entry : density) sum += entry.second;
-  for (auto& entry : density) entry.second /= sum;
+  public:
+
+    Side(const Criterion& criterion, const CategoryFrequency& counts) :
+      criterion_(criterion), counts_(counts), total_(0)
+    {
+      for (double count : counts_)
+      {
+        total_ += count;
+        criterion_.update(state_, 0, count);
+      }
+    }
+
+    /* Adds weight to the count of class_ (removes it if negative). */
+    void add(Code class_, double weight)
+    {
+      double& count = counts_[class_];
+      criterion_.update(state_, count, weight);
+      count += weight;
+      total_ += weight;
+    }
+
+    double get_total() const { return total_; }
+
+    /* Impurity of the side (NaN if empty, so that splits that leave a side
+     * empty are never chosen). */
+    double impurity() const
+    {
+      if (not (total_ > 0)) return std::numeric_limits<double>::quiet_NaN();
+      return criterion_.impurity(state_, counts_, total_);
+    }
+
+  private:
+
+    Criterion criterion_;
+    CategoryFrequency counts_;
+    double total_;
+    typename Criterion::State state_;
+};
+
+// sorts rows by their value in numbers, missing values (NaN) last
+void sort_rows(const ColumnData<double>& numbers, std::vector<int>& rows)
+{
+  auto cmp = [&numbers](int a, int b)
+  {
+    return numbers[a] < numbers[b] or
+      (std::isnan(numbers[b]) and not std::isnan(numbers[a]));
+  };
+  std::sort(rows.begin(), rows.end(), cmp);
 }
 
-void shuffle(std::vector<int>& v, int f)
+// partial Fisher-Yates: only the first f positions are randomized
+void shuffle(std::vector<int>& v, int f, Rng& rng)
 {
   for (int idx = 0; idx < f; ++idx)
   {
-    int jdx = std::rand() % v.size();
+    int jdx = idx + rng.uniform(v.size() - idx);
     std::swap(v[idx], v[jdx]);
   }
 }
 
+// stable partition that keeps the rows of the right side in scratch
+template <typename GoesLeft>
+int* partition_rows(int* begin, int* end, int* scratch, GoesLeft goes_left)
+{
+  int* left = begin;
+  int* right = scratch;
+  for (int* row = begin; row != end; ++row)
+  {
+    if (goes_left(*row)) *left++ = *row;
+    else *right++ = *row;
+  }
+  std::copy(scratch, right, left);
+  return left;
+}
+
 }
 
 double entropy(const CategoryFrequency& density)
 {
   double h = 0;
-  for (const auto& entry : density)
+  for (double p : density)
   {
-    double p = entry.second;
     if (p > 0) h -= p*std::log2(p);
   }
   return h;
@@ -41,9 +104,8 @@ double entropy(const CategoryFrequency& density)
 double gini(const CategoryFrequency& density)
 {
   double g = 1;
-  for (const auto& entry : density)
+  for (double p : density)
   {
-    double p = entry.second;
     g -= p*p;
   }
   return g;
@@ -52,13 +114,175 @@ double gini(const CategoryFrequency& density)
 double error(const CategoryFrequency& density)
 {
   double pmax = 0;
-  for (const auto& entry : density)
+  for (double p : density)
   {
-    pmax = std::max(pmax, entry.second);
+    pmax = std::max(pmax, p);
   }
   return 1 - pmax;
 }
 
+SortedColumns::SortedColumns(const Dataframe& data) :
+  orders_(data.get_nattributes())
+{
+  for (int column = 0; column < data.get_nattributes(); ++column)
+  {
+    if (column == data.get_target_idx()) continue;
+    if (not data.get_attribute(column).numeric) continue;
+    const ColumnData<double>& numbers = data.get_root().get_column(column).numbers;
+    std::vector<int>& order = orders_[column];
+    order.resize(data.get_nrecords());
+    for (int idx = 0; idx < data.get_nrecords(); ++idx)
+    {
+      order[idx] = data.get_row(idx);
+    }
+    sort_rows(numbers, order);
+  }
+}
+
+SortedColumns::SortedColumns(const SortedColumns& parent,
+    const Dataframe& subset) :
+  orders_(parent.orders_.size()), marks_(parent.marks_)
+{
+  if (not marks_)
+  {
+    int nrows = subset.get_root().get_nrecords();
+    marks_ = std::make_shared<std::vector<bool>>(nrows, false);
+  }
+  std::vector<bool>& marks = *marks_;
+  for (int idx = 0; idx < subset.get_nrecords(); ++idx)
+  {
+    marks[subset.get_row(idx)] = true;
+  }
+  for (int column = 0; column < orders_.size(); ++column)
+  {
+    const std::vector<int>& parent_order = parent.orders_[column];
+    if (parent_order.empty()) continue;
+    std::vector<int>& order = orders_[column];
+    order.reserve(subset.get_nrecords());
+    for (int row : parent_order)
+    {
+      if (marks[row]) order.push_back(row);
+    }
+  }
+  for (int idx = 0; idx < subset.get_nrecords(); ++idx)
+  {
+    marks[subset.get_row(idx)] = false;
+  }
+}
+
+void SortedColumns::split(const Dataframe& left, Ptr& left_sorted,
+    Ptr& right_sorted) const
+{
+  left_sorted.reset(new SortedColumns);
+  right_sorted.reset(new SortedColumns);
+  left_sorted->orders_.resize(orders_.size());
+  right_sorted->orders_.resize(orders_.size());
+  left_sorted->marks_ = right_sorted->marks_ = marks_;
+  std::vector<bool>& marks = *marks_;
+  for (int idx = 0; idx < left.get_nrecords(); ++idx)
+  {
+    marks[left.get_row(idx)] = true;
+  }
+  for (int column = 0; column < orders_.size(); ++column)
+  {
+    const std::vector<int>& order = orders_[column];
+    if (order.empty()) continue;
+    std::vector<int>& left_order = left_sorted->orders_[column];
+    std::vector<int>& right_order = right_sorted->orders_[column];
+    left_order.reserve(left.get_nrecords());
+    right_order.reserve(order.size() - left.get_nrecords());
+    for (int row : order)
+    {
+      if (marks[row]) left_order.push_back(row);
+      else right_order.push_back(row);
+    }
+  }
+  for (int idx = 0; idx < left.get_nrecords(); ++idx)
+  {
+    marks[left.get_row(idx)] = false;
+  }
+}
+
+const int BinnedColumns::max_bins;
+
+BinnedColumns::BinnedColumns(const Dataframe& data, int nbins) :
+  bins_(data.get_nattributes()), lower_(data.get_nattributes()),
+  upper_(data.get_nattributes()),
+  nclasses_(data.get_root().get_column(data.get_target_idx()).dictionary.size())
+{
+  nbins = std::max(1, std::min(nbins, max_bins));
+  for (int column = 0; column < data.get_nattributes(); ++column)
+  {
+    if (column == data.get_target_idx()) continue;
+    if (not data.get_attribute(column).numeric) continue;
+    const ColumnData<double>& numbers = data.get_root().get_column(column).numbers;
+    std::vector<double> values;
+    values.reserve(data.get_nrecords());
+    for (int idx = 0; idx < data.get_nrecords(); ++idx)
+    {
+      double x = numbers[data.get_row(idx)];
+      if (not std::isnan(x)) values.push_back(x);
+    }
+    std::sort(values.begin(), values.end());
+    std::vector<double> distinct(values);
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    /* Upper edges of the bins: either every distinct value or quantiles. */
+    std::vector<double> edges;
+    if (distinct.size() <= nbins) edges.swap(distinct);
+    else
+    {
+      for (int bin = 1; bin <= nbins; ++bin)
+      {
+        double edge = values[(long)bin*values.size()/nbins - 1];
+        if (edges.empty() or edges.back() < edge) edges.push_back(edge);
+      }
+    }
+    if (edges.empty()) edges.push_back(0);
+    std::vector<std::uint8_t>& bins = bins_[column];
+    bins.assign(data.get_root().get_nrecords(), 0);
+    lower_[column].assign(edges.size(), inf);
+    upper_[column].assign(edges.size(), -inf);
+    for (int idx = 0; idx < data.get_nrecords(); ++idx)
+    {
+      int row = data.get_row(idx);
+      double x = numbers[row];
+      if (std::isnan(x))
+      {
+        /* Missing values never go left, like in send_left. */
+        bins[row] = edges.size() - 1;
+        continue;
+      }
+      int bin = std::lower_bound(edges.begin(), edges.end(), x) - edges.begin();
+      bins[row] = bin;
+      lower_[column][bin] = std::min(lower_[column][bin], x);
+      upper_[column][bin] = std::max(upper_[column][bin], x);
+    }
+  }
+}
+
+void BinnedColumns::histogram(const Dataframe& data, int column,
+    Histogram& hist) const
+{
+  const Column& target = data.get_root().get_column(data.get_target_idx());
+  const Dataframe::Weights& weights = data.get_weights();
+  const std::vector<std::uint8_t>& bins = bins_[column];
+  hist.assign(get_nbins(column)*nclasses_, 0);
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    int row = data.get_row(idx);
+    hist[bins[row]*nclasses_ + target.codes[row]] +=
+      weights? (*weights)[row] : 1;
+  }
+}
+
+void BinnedColumns::complement(const Histogram& parent, Histogram& hist)
+{
+  for (int idx = 0; idx < hist.size(); ++idx)
+  {
+    hist[idx] = parent[idx] - hist[idx];
+  }
+}
+
 DecisionStump* DecisionStump::from_json(json& stump)
 {
   bool numeric = stump.at("attr").at("numeric").get<bool>();
@@ -89,59 +313,134 @@ NumericDecisionStump::NumericDecisionStump(json& stump)
   thr_ = stump.at("thr");
 }
 
+template <class Criterion>
 NumericDecisionStump::NumericDecisionStump(const Dataframe& data, int split,
-    Metric metric, Dataframe::Ptr& left, Dataframe::Ptr& right) :
+    const Criterion& criterion) :
   DecisionStump(data, split)
 {
-  View sorted(const_cast<Dataframe&>(data)); // we won't modify the data
-  sorted.sort_by_column(split_);
-  int target_idx = sorted.get_target_idx();
-  CategoryFrequency counts_i, counts_ip, probs_i, probs_ip;
-  sorted.category_freq(target_idx, counts_ip, false);
-  counts_i = counts_ip;
+  const ColumnData<double>& numbers = data.get_root().get_column(split).numbers;
+  std::vector<int> sorted(data.get_nrecords());
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    sorted[idx] = data.get_row(idx);
+  }
+  sort_rows(numbers, sorted);
+  fit(data, sorted, criterion);
+}
+
+template <class Criterion>
+NumericDecisionStump::NumericDecisionStump(const Dataframe& data, int split,
+    const Criterion& criterion, const std::vector<int>& sorted) :
+  DecisionStump(data, split)
+{
+  fit(data, sorted, criterion);
+}
+
+template <class Criterion>
+void NumericDecisionStump::fit(const Dataframe& data,
+    const std::vector<int>& sorted, const Criterion& criterion)
+{
+  int target_idx = data.get_target_idx();
+  const Column& column = data.get_root().get_column(split_);
+  const Column& target = data.get_root().get_column(target_idx);
+  const Dataframe::Weights& weights = data.get_weights();
+  CategoryFrequency counts;
+  data.category_freq(target_idx, counts, false);
+  Side<Criterion> side_i(criterion, CategoryFrequency(counts.size(), 0));
+  Side<Criterion> side_ip(criterion, counts);
+  double total = side_ip.get_total();
   m_lowest_ = inf;
   int idx_best = -1;
-  for (auto& entry : counts_i) entry.second = 0;
-  double previous = sorted.get_instance(0).get(split).get_number();
-  for (int idx = 1; idx < sorted.get_nrecords(); ++idx)
-  {
-    double current = sorted.get_instance(idx).get(split).get_number();
-    const std::string& class_ = sorted.get_instance(idx-1).get(
-        target_idx).get_category();
-    counts_i[class_] += 1;
-    counts_ip[class_] -= 1;
+  double previous = column.numbers[sorted[0]];
+  for (int idx = 1; idx < sorted.size(); ++idx)
+  {
+    int row = sorted[idx-1];
+    double current = column.numbers[sorted[idx]];
+    double weight = weights? (*weights)[row] : 1;
+    Code class_ = target.codes[row];
+    side_i.add(class_, weight);
+    side_ip.add(class_, -weight);
     if (previous < current)
     {
-      double p_i = ((double)idx)/sorted.get_nrecords();
+      double p_i = side_i.get_total()/total;
       double p_ip = 1 - p_i;
-      normalize(counts_i, probs_i);
-      normalize(counts_ip, probs_ip);
-      double m_i = metric(probs_i);
-      double m_ip = metric(probs_ip);
-      double m = p_i*m_i + p_ip*m_ip;
+      double m = p_i*side_i.impurity() + p_ip*side_ip.impurity();
       if  (m < m_lowest_)
       {
         idx_best = idx;
         m_lowest_ = m;
       }
-      //std::cout << "m: " << m << std::endl;
     }
     previous = current;
   }
-  //std::cout << "m_lowest: " << m_lowest_ << std::endl;
-  double x_l = sorted.get_instance(idx_best-1).get(split).get_number();
-  double x_r = sorted.get_instance(idx_best).get(split).get_number();
+  if (idx_best < 0) return; // only missing values besides a single one
+  double x_l = column.numbers[sorted[idx_best-1]];
+  double x_r = column.numbers[sorted[idx_best]];
   thr_ = (x_l + x_r)/2;
-  left.reset(new View(sorted, 0, idx_best));
-  right.reset(new View(sorted, idx_best));
+}
+
+template <class Criterion>
+NumericDecisionStump::NumericDecisionStump(const Dataframe& data, int split,
+    const Criterion& criterion, const BinnedColumns& binned,
+    const BinnedColumns::Histogram& hist) :
+  DecisionStump(data, split)
+{
+  int nclasses = binned.get_nclasses();
+  std::vector<int> nonempty;
+  CategoryFrequency counts(nclasses, 0);
+  for (int bin = 0; bin < binned.get_nbins(split); ++bin)
+  {
+    double bin_total = 0;
+    for (int class_ = 0; class_ < nclasses; ++class_)
+    {
+      counts[class_] += hist[bin*nclasses + class_];
+      bin_total += hist[bin*nclasses + class_];
+    }
+    if (bin_total > 0) nonempty.push_back(bin);
+  }
+  Side<Criterion> side_i(criterion, CategoryFrequency(nclasses, 0));
+  Side<Criterion> side_ip(criterion, counts);
+  double total = side_ip.get_total();
+  m_lowest_ = inf;
+  int idx_best = -1;
+  for (int idx = 1; idx < nonempty.size(); ++idx)
+  {
+    const double* bin_counts = &hist[nonempty[idx-1]*nclasses];
+    for (int class_ = 0; class_ < nclasses; ++class_)
+    {
+      if (bin_counts[class_] == 0) continue;
+      side_i.add(class_, bin_counts[class_]);
+      side_ip.add(class_, -bin_counts[class_]);
+    }
+    double p_i = side_i.get_total()/total;
+    double p_ip = 1 - p_i;
+    double m = p_i*side_i.impurity() + p_ip*side_ip.impurity();
+    if (m < m_lowest_)
+    {
+      idx_best = idx;
+      m_lowest_ = m;
+    }
+  }
+  if (idx_best < 0) return; // a single bin, no possible split
+  int bin_l = nonempty[idx_best-1];
+  thr_ = binned.get_threshold(split_, bin_l, nonempty[idx_best]);
 }
 
 bool NumericDecisionStump::send_left(const Instance& instance) const
 {
-  double x = instance.get(split_).get_number();
+  double x = instance.get_number(split_);
   return x < thr_;
 }
 
+int* NumericDecisionStump::partition(const Table& root, int* begin,
+    int* end, int* scratch) const
+{
+  const ColumnData<double>& numbers = root.get_column(split_).numbers;
+  double thr = thr_;
+  return partition_rows(begin, end, scratch,
+      [&numbers, thr](int row) { return numbers[row] < thr; });
+}
+
 void NumericDecisionStump::to_json(json& stump) const
 {
   DecisionStump::to_json(stump);
@@ -158,81 +457,204 @@ std::string NumericDecisionStump::to_str() const
 CategoricalDecisionStump::CategoricalDecisionStump(json& stump)
 {
   attr_.numeric = false;
-  to_left_ = stump.at("to_left");
+  /* Older forests send a single category left. */
+  const json& to_left = stump.at("to_left");
+  if (to_left.is_string()) categories_.encode(to_left.get<std::string>());
+  else
+  {
+    for (const json& category : to_left)
+    {
+      categories_.encode(category.get<std::string>());
+    }
+  }
+  to_left_.assign(categories_.size(), true);
 }
 
+CategoricalDecisionStump::CategoricalDecisionStump(const std::string& name,
+    int split, const std::vector<std::string>& to_left) :
+  DecisionStump(Attribute{name, false}, split)
+{
+  for (const std::string& category : to_left) categories_.encode(category);
+  to_left_.assign(categories_.size(), true);
+}
+
+template <class Criterion>
 CategoricalDecisionStump::CategoricalDecisionStump(const Dataframe& data,
-    int split, Metric metric, Dataframe::Ptr& left, Dataframe::Ptr& right) :
+    int split, const Criterion& criterion) :
   DecisionStump(data, split)
 {
-  int target_idx = data.get_target_idx();
-  Dataframe::Partition part;
-  data.partition(split, part);
-  CategoryFrequency counts, counts_l, counts_r, probs_l, probs_r;
-  data.category_freq(target_idx, counts, false);
+  const Table& root = data.get_root();
+  const Column& column = root.get_column(split);
+  const Column& target = root.get_column(data.get_target_idx());
+  const Dataframe::Weights& weights = data.get_weights();
+  int ncategories = column.dictionary.size();
+  int nclasses = target.dictionary.size();
+  /* Contingency table: class counts of each category, category after
+   * category. */
+  std::vector<double> table(ncategories*nclasses, 0);
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    int row = data.get_row(idx);
+    table[column.codes[row]*nclasses + target.codes[row]] +=
+      weights? (*weights)[row] : 1;
+  }
+  CategoryFrequency counts(nclasses, 0);
+  std::vector<double> sizes(ncategories, 0);
+  std::vector<Code> present;
+  for (Code code = 0; code < ncategories; ++code)
+  {
+    for (int class_ = 0; class_ < nclasses; ++class_)
+    {
+      counts[class_] += table[code*nclasses + class_];
+      sizes[code] += table[code*nclasses + class_];
+    }
+    if (sizes[code] > 0) present.push_back(code);
+  }
   m_lowest_ = inf;
-  for (const auto& entry : part)
+  if (present.size() < 2) return;
+  double total = 0;
+  for (double count : counts) total += count;
+  int majority = std::max_element(counts.begin(), counts.end()) -
+    counts.begin();
+  auto share = [&](Code code)
   {
-    entry.second->category_freq(target_idx, counts_l, false);
-    counts_r = counts;
-    for (const auto& catfreq : counts_l)
+    return table[code*nclasses + majority]/sizes[code];
+  };
+  std::vector<Code> order(present);
+  std::stable_sort(order.begin(), order.end(),
+      [&](Code a, Code b) { return share(a) < share(b); });
+  /* Splits are either a prefix of order (nbest categories) or a single
+   * category. */
+  int nbest = 0;
+  long single = -1;
+  Side<Criterion> side_l(criterion, CategoryFrequency(nclasses, 0));
+  Side<Criterion> side_r(criterion, counts);
+  for (int idx = 0; idx + 1 < order.size(); ++idx)
+  {
+    const double* category_counts = &table[order[idx]*nclasses];
+    for (int class_ = 0; class_ < nclasses; ++class_)
     {
-      counts_r[catfreq.first] -= catfreq.second;
+      if (category_counts[class_] == 0) continue;
+      side_l.add(class_, category_counts[class_]);
+      side_r.add(class_, -category_counts[class_]);
     }
-    normalize(counts_l, probs_l);
-    normalize(counts_r, probs_r);
-    double p_l = entry.second->get_nrecords() / (double)data.get_nrecords();
+    double p_l = side_l.get_total()/total;
     double p_r = 1 - p_l;
-    double m_l = metric(probs_l);
-    double m_r = metric(probs_r);
-    double m = p_l*m_l + p_r*m_r;
-    //std::cout << "m: " << m << std::endl;
+    double m = p_l*side_l.impurity() + p_r*side_r.impurity();
     if (m < m_lowest_)
     {
-      to_left_ = entry.first;
+      nbest = idx + 1;
       m_lowest_ = m;
     }
-    if (part.size() == 2) break; // no need to continue
   }
-  //std::cout << "m_lowest: " << m_lowest_ << std::endl;
-  left = std::move(part[to_left_]);
-  right.reset(new View(const_cast<Dataframe&>(data), split, to_left_));
+  int nclasses_present = nclasses - std::count(counts.begin(), counts.end(), 0);
+  if (nclasses_present > 2 and present.size() > 2)
+  {
+    CategoryFrequency counts_l(nclasses), counts_r(nclasses);
+    for (Code code : present)
+    {
+      for (int class_ = 0; class_ < nclasses; ++class_)
+      {
+        counts_l[class_] = table[code*nclasses + class_];
+        counts_r[class_] = counts[class_] - counts_l[class_];
+      }
+      Side<Criterion> single_l(criterion, counts_l);
+      Side<Criterion> single_r(criterion, counts_r);
+      double p_l = single_l.get_total()/total;
+      double p_r = 1 - p_l;
+      double m = p_l*single_l.impurity() + p_r*single_r.impurity();
+      if (m < m_lowest_)
+      {
+        single = code;
+        m_lowest_ = m;
+      }
+    }
+  }
+  if (m_lowest_ == inf) return;
+  std::vector<bool> goes_left(ncategories, false);
+  if (single >= 0) goes_left[single] = true;
+  else
+  {
+    for (int idx = 0; idx < nbest; ++idx) goes_left[order[idx]] = true;
+  }
+  for (Code code : present)
+  {
+    categories_.encode(column.dictionary.decode(code));
+    to_left_.push_back(goes_left[code]);
+  }
+  column_left_ = std::move(goes_left);
 }
 
 bool CategoricalDecisionStump::send_left(const Instance& instance) const
 {
-  const std::string& cat = instance.get(split_).get_category();
-  return cat == to_left_;
+  long code = categories_.find(instance.get_category(split_));
+  return code >= 0 and to_left_[code];
+}
+
+int* CategoricalDecisionStump::partition(const Table& root, int* begin,
+    int* end, int* scratch) const
+{
+  const Column& column = root.get_column(split_);
+  std::vector<bool> goes_left;
+  if (column_left_.empty())
+  {
+    /* Loaded stump: translate the categories to the codes of root. */
+    goes_left.resize(column.dictionary.size(), false);
+    for (Code code = 0; code < column.dictionary.size(); ++code)
+    {
+      long stump_code = categories_.find(column.dictionary.decode(code));
+      goes_left[code] = stump_code >= 0 and to_left_[stump_code];
+    }
+  }
+  const std::vector<bool>& left = column_left_.empty()? goes_left :
+    column_left_;
+  return partition_rows(begin, end, scratch,
+      [&](int row) { return left[column.codes[row]]; });
+}
+
+std::vector<std::string> CategoricalDecisionStump::get_to_left() const
+{
+  std::vector<std::string> to_left;
+  for (Code code = 0; code < categories_.size(); ++code)
+  {
+    if (to_left_[code]) to_left.push_back(categories_.decode(code));
+  }
+  return to_left;
 }
 
 void CategoricalDecisionStump::to_json(json& stump) const
 {
   DecisionStump::to_json(stump);
-  stump["to_left"] = to_left_;
+  stump["to_left"] = get_to_left();
 }
 
 std::string CategoricalDecisionStump::to_str() const
 {
-  return attr_.name + "=" + to_left_;
+  std::vector<std::string> to_left = get_to_left();
+  if (to_left.size() == 1) return attr_.name + "=" + to_left[0];
+  std::string str = attr_.name + " in {";
+  for (int idx = 0; idx < to_left.size(); ++idx)
+  {
+    str += (idx? "," : "") + to_left[idx];
+  }
+  return str + "}";
 }
 
 DecisionTree::DecisionTree(json& tree) :
   stump_(nullptr), left_(nullptr), right_(nullptr)
 {
   //std::cout << tree << std::endl;
-  try
+  if (tree.find("stump") != tree.end())
   {
     stump_ = DecisionStump::from_json(tree.at("stump"));
     left_ = new DecisionTree(tree.at("left"));
     right_ = new DecisionTree(tree.at("right"));
   }
-  catch (json::out_of_range)
-  {
-    guess_ = tree.at("guess");
-  }
+  else guess_ = tree.at("guess");
 }
 
-DecisionTree::DecisionTree(const Dataframe& data, int n, int f, Metric m) :
+DecisionTree::DecisionTree(const Dataframe& data, int n, int f, Metric m,
+    Rng& rng, const SortedColumns* sorted, const BinnedColumns* binned) :
   stump_(nullptr), left_(nullptr), right_(nullptr)
 {
   int n_attr = data.get_nattributes();
@@ -241,14 +663,19 @@ DecisionTree::DecisionTree(const Dataframe& data, int n, int f, Metric m) :
   {
     if (idx != data.get_target_idx()) candidate_features.push_back(idx);
   }
-  fit(data, n, f, m, candidate_features);
+  SortedColumns::Ptr subset;
+  if (sorted) subset.reset(new SortedColumns(*sorted, data));
+  fit(data, n, f, m, rng, candidate_features, std::move(subset), binned);
 }
 
 DecisionTree::DecisionTree(const Dataframe& data, int n, int f, Metric m,
-    const std::vector<int>& candidate_features) :
+    Rng& rng, const std::vector<int>& candidate_features,
+    const SortedColumns* sorted, const BinnedColumns* binned) :
   stump_(nullptr), left_(nullptr), right_(nullptr)
 {
-  fit(data, n, f, m, candidate_features);
+  SortedColumns::Ptr subset;
+  if (sorted) subset.reset(new SortedColumns(*sorted, data));
+  fit(data, n, f, m, rng, candidate_features, std::move(subset), binned);
 }
 
 std::string DecisionTree::classify(const Instance& instance) const
@@ -346,24 +773,37 @@ void DecisionTree::extract_mode_as_guess(const Dataframe& data)
 {
   CategoryFrequency freq;
   data.category_freq(data.get_target_idx(), freq, false);
+  const Dictionary& classes =
+    data.get_root().get_column(data.get_target_idx()).dictionary;
   double max_occurrences = 0;
-  for (const auto& entry : freq)
+  for (Code code = 0; code < freq.size(); ++code)
   {
-    if (entry.second > max_occurrences)
+    if (freq[code] > max_occurrences)
     {
-      guess_ = entry.first;
-      max_occurrences = entry.second;
+      guess_ = classes.decode(code);
+      max_occurrences = freq[code];
     }
   }
 }
 
 bool DecisionTree::all_equal(const Dataframe& data, int column)
 {
-  const Value* first = &data.get_instance(0).get(column);
-  for (int idx = 1; idx < data.get_nrecords(); ++idx)
+  const Column& col = data.get_root().get_column(column);
+  if (data.get_attribute(column).numeric)
+  {
+    double first = col.numbers[data.get_row(0)];
+    for (int idx = 1; idx < data.get_nrecords(); ++idx)
+    {
+      if (col.numbers[data.get_row(idx)] != first) return false;
+    }
+  }
+  else
   {
-    const Value* current = &data.get_instance(idx).get(column);
-    if (*current != *first) return false;
+    Code first = col.codes[data.get_row(0)];
+    for (int idx = 1; idx < data.get_nrecords(); ++idx)
+    {
+      if (col.codes[data.get_row(idx)] != first) return false;
+    }
   }
   return true;
 }
@@ -379,7 +819,45 @@ void DecisionTree::filter_features(const Dataframe& data,
 }
 
 void DecisionTree::fit(const Dataframe& data, int n, int f, Metric m,
-    const std::vector<int>& candidate_features)
+    Rng& rng, const std::vector<int>& candidate_features,
+    SortedColumns::Ptr sorted, const BinnedColumns* binned)
+{
+  std::vector<int> rows(data.get_nrecords());
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    rows[idx] = data.get_row(idx);
+  }
+  Slice slice(data.get_root(), rows.data(), rows.data() + rows.size(),
+      data.get_weights());
+  std::vector<int> scratch(rows.size());
+  if (m == gini)
+  {
+    grow(slice, n, f, GiniCriterion(), rng, candidate_features,
+        std::move(sorted), binned, nullptr, nullptr, scratch.data());
+  }
+  else if (m == entropy)
+  {
+    grow(slice, n, f, EntropyCriterion(), rng, candidate_features,
+        std::move(sorted), binned, nullptr, nullptr, scratch.data());
+  }
+  else if (m == error)
+  {
+    grow(slice, n, f, ErrorCriterion(), rng, candidate_features,
+        std::move(sorted), binned, nullptr, nullptr, scratch.data());
+  }
+  else
+  {
+    grow(slice, n, f, MetricCriterion(m), rng, candidate_features,
+        std::move(sorted), binned, nullptr, nullptr, scratch.data());
+  }
+}
+
+template <class Criterion>
+void DecisionTree::grow(const Slice& data, int n, int f,
+    const Criterion& criterion, Rng& rng,
+    const std::vector<int>& candidate_features, SortedColumns::Ptr sorted,
+    const BinnedColumns* binned, const BinnedColumns::Histograms* parent_hists,
+    const Dataframe* sibling, int* scratch)
 {
   if (data.get_nrecords() < n)
   {
@@ -390,7 +868,7 @@ void DecisionTree::fit(const Dataframe& data, int n, int f, Metric m,
   if (all_equal(data, data.get_target_idx()))
   {
     // no variability in target attribute
-    guess_ = data.get_instance(0).get(data.get_target_idx()).get_category();
+    guess_ = data.get_instance(0).get_category(data.get_target_idx());
     return;
   }
   std::vector<int> filtered;
@@ -402,38 +880,101 @@ void DecisionTree::fit(const Dataframe& data, int n, int f, Metric m,
     return;
   }
   int f_ = std::min(f, (int)filtered.size());
-  shuffle(filtered, f_);
+  shuffle(filtered, f_, rng);
 
   DecisionStump* best = nullptr;
-  Dataframe::Ptr left_data, right_data;
+  BinnedColumns::Histograms hists(binned? data.get_nattributes() : 0);
 
   for (int idx = 0; idx < f_; ++idx)
   {
     int column = filtered[idx];
     DecisionStump* stump;
-    Dataframe::Ptr left, right;
-    if (data.get_attribute(column).numeric)
+    if (data.get_attribute(column).numeric and binned)
     {
-      stump = new NumericDecisionStump(data, column, m, left, right);
+      BinnedColumns::Histogram& hist = hists[column];
+      if (parent_hists and not (*parent_hists)[column].empty() and
+          sibling->get_nrecords() < data.get_nrecords())
+      {
+        binned->histogram(*sibling, column, hist);
+        BinnedColumns::complement((*parent_hists)[column], hist);
+      }
+      else binned->histogram(data, column, hist);
+      stump = new NumericDecisionStump(data, column, criterion, *binned, hist);
+    }
+    else if (data.get_attribute(column).numeric and sorted)
+    {
+      stump = new NumericDecisionStump(data, column, criterion,
+          sorted->get_order(column));
+    }
+    else if (data.get_attribute(column).numeric)
+    {
+      stump = new NumericDecisionStump(data, column, criterion);
     }
     else
     {
-      stump = new CategoricalDecisionStump(data, column, m, left, right);
+      stump = new CategoricalDecisionStump(data, column, criterion);
     }
-    //std::cout << "stump->get_m(): " << stump->get_m() << std::endl;
-    if (not best or stump->get_m() < best->get_m())
+    if (stump->get_m() == inf)
+    {
+      // no possible split (e.g. all the values fall in the same bin)
+      delete stump;
+    }
+    else if (not best or stump->get_m() < best->get_m())
     {
       delete best;
       best = stump;
-      left_data = std::move(left);
-      right_data = std::move(right);
     }
   }
-  //std::cout << "best->get_m(): " << best->get_m() << std::endl;
+  if (not best)
+  {
+    extract_mode_as_guess(data);
+    return;
+  }
+  const Table& root = data.get_root();
+  int* middle = best->partition(root, data.begin(), data.end(), scratch);
+  if (middle == data.begin() or middle == data.end())
+  {
+    // the threshold rounds to one of the values around it
+    delete best;
+    extract_mode_as_guess(data);
+    return;
+  }
   stump_ = best;
-  left_ = new DecisionTree(*left_data, n, f, m, filtered);
-  right_ = new DecisionTree(*right_data, n, f, m, filtered);
-}
+  Slice left_data(root, data.begin(), middle, data.get_weights());
+  Slice right_data(root, middle, data.end(), data.get_weights());
+  SortedColumns::Ptr left_sorted, right_sorted;
+  if (sorted)
+  {
+    sorted->split(left_data, left_sorted, right_sorted);
+    sorted.reset(); // the children do not need the orders of this node
+  }
+  left_ = new DecisionTree;
+  left_->grow(left_data, n, f, criterion, rng, filtered,
+      std::move(left_sorted), binned, &hists, &right_data, scratch);
+  right_ = new DecisionTree;
+  right_->grow(right_data, n, f, criterion, rng, filtered,
+      std::move(right_sorted), binned, &hists, &left_data, scratch);
+}
+
+/* Stumps are built by DecisionTree, and by users of this library with the
+ * criteria of tree.h. */
+#define SEL_INSTANTIATE_STUMPS(Criterion) \
+  template NumericDecisionStump::NumericDecisionStump(const Dataframe&, int, \
+      const Criterion&); \
+  template NumericDecisionStump::NumericDecisionStump(const Dataframe&, int, \
+      const Criterion&, const std::vector<int>&); \
+  template NumericDecisionStump::NumericDecisionStump(const Dataframe&, int, \
+      const Criterion&, const BinnedColumns&, \
+      const BinnedColumns::Histogram&); \
+  template CategoricalDecisionStump::CategoricalDecisionStump( \
+      const Dataframe&, int, const Criterion&);
+
+SEL_INSTANTIATE_STUMPS(GiniCriterion)
+SEL_INSTANTIATE_STUMPS(EntropyCriterion)
+SEL_INSTANTIATE_STUMPS(ErrorCriterion)
+SEL_INSTANTIATE_STUMPS(MetricCriterion)
+
+#undef SEL_INSTANTIATE_STUMPS
 
 }
 
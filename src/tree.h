@@ -4,14 +4,16 @@
 #include "dataframe.h"
 #include "json.hpp"
 
+#include <algorithm>
 #include <cmath>
 
-
 namespace sel
 {
 
 using nlohmann::json;
 
+class SortedColumns;
+class BinnedColumns;
 class DecisionStump;
 class NumericDecisionStump;
 class CategoricalDecisionStump;
@@ -19,12 +21,236 @@ class DecisionTree;
 
 typedef double (*Metric)(const CategoryFrequency&);
 
+/** 
+ * @brief Strategies to find the best threshold of numeric attributes.
+ */
+enum class SplitSearch
+{
+  exact,     /* sort the records of each node by each candidate attribute */
+  presorted, /* sort once, then keep the orders with stable partitions */
+  histogram  /* quantize once, then scan per-bin class histograms */
+};
+
 double entropy(const CategoryFrequency& density);
 
 double gini(const CategoryFrequency& density);
 
 double error(const CategoryFrequency& density);
 
+/** 
+ * @brief Split criteria, the policies of the split search.
+ *
+ * Split search is a template on the criterion, so that the impurity of each
+ * candidate threshold is computed inline instead of through a Metric. A
+ * criterion keeps a State with running sums of the class counts of one side
+ * of a split:
+ *  - update(state, count, weight) is called before the count of a class goes
+ *    from count to count + weight (weight is negative for removals);
+ *  - impurity(state, counts, total) is the impurity of a side given its class
+ *    counts and their (positive) total.
+ *
+ * DecisionTree picks the criterion of its Metric once per tree.
+ */
+struct GiniCriterion
+{
+  struct State { double squares = 0; };
+
+  void update(State& state, double count, double weight) const
+  {
+    state.squares += weight*(2*count + weight);
+  }
+
+  double impurity(const State& state, const CategoryFrequency& counts,
+      double total) const
+  {
+    return 1 - state.squares/(total*total);
+  }
+};
+
+struct EntropyCriterion
+{
+  struct State { double xlogx = 0; };
+
+  static double xlog2x(double x) { return x > 0? x*std::log2(x) : 0; }
+
+  void update(State& state, double count, double weight) const
+  {
+    state.xlogx -= xlog2x(count);
+    state.xlogx += xlog2x(count + weight);
+  }
+
+  double impurity(const State& state, const CategoryFrequency& counts,
+      double total) const
+  {
+    return std::log2(total) - state.xlogx/total;
+  }
+};
+
+struct ErrorCriterion
+{
+  struct State {};
+
+  void update(State& state, double count, double weight) const {}
+
+  double impurity(const State& state, const CategoryFrequency& counts,
+      double total) const
+  {
+    return 1 - *std::max_element(counts.begin(), counts.end())/total;
+  }
+};
+
+/** 
+ * @brief Any other Metric, called on the normalized class counts.
+ */
+class MetricCriterion
+{
+  public:
+
+    struct State {};
+
+    explicit MetricCriterion(Metric metric) : metric_(metric) {}
+
+    void update(State& state, double count, double weight) const {}
+
+    double impurity(const State& state, const CategoryFrequency& counts,
+        double total) const
+    {
+      probs_.resize(counts.size());
+      for (int idx = 0; idx < counts.size(); ++idx)
+      {
+        probs_[idx] = counts[idx]/total;
+      }
+      return metric_(probs_);
+    }
+
+  private:
+
+    Metric metric_;
+    mutable CategoryFrequency probs_;
+};
+
+/** 
+ * @brief Rows of a dataframe sorted by each of its numeric attributes.
+ *
+ * Sorting happens only once. The orders of a subset of the records (e.g. a
+ * bootstrap sample or the children of a node) are obtained by filtering the
+ * orders of the parent, which preserves them. Hence, the split search of
+ * each node becomes a linear scan (as in SLIQ/SPRINT).
+ */
+class SortedColumns
+{
+  public:
+
+    typedef std::unique_ptr<SortedColumns> Ptr;
+
+    /** 
+     * @brief Sorts the records of data by each numeric attribute.
+     */
+    explicit SortedColumns(const Dataframe& data);
+
+    /** 
+     * @param parent Orders of a superset of the records of subset.
+     * @param subset Records to keep.
+     */
+    SortedColumns(const SortedColumns& parent, const Dataframe& subset);
+
+    /** 
+     * @return Rows (of the root table) sorted by the given (numeric) column.
+     */
+    const std::vector<int>& get_order(int column) const
+    {
+      return orders_[column];
+    }
+
+    /** 
+     * @brief Splits the orders between the records of left and the rest, in
+     * a single pass.
+     */
+    void split(const Dataframe& left, Ptr& left_sorted, Ptr& right_sorted) const;
+
+  private:
+
+    SortedColumns() {}
+
+    std::vector<std::vector<int>> orders_;
+    /* Scratch space with one mark per row of the root table, shared by the
+     * subsets of a same tree. */
+    std::shared_ptr<std::vector<bool>> marks_;
+};
+
+/** 
+ * @brief Numeric attributes of a dataframe quantized into a few bins.
+ *
+ * Each value is replaced by the (8 bit) index of its bin. Bins hold the same
+ * number of records (as far as ties allow), and there is one bin per distinct
+ * value when there are few enough of them. Split search then evaluates only
+ * the boundaries between bins, from the class histogram of each bin.
+ */
+class BinnedColumns
+{
+  public:
+
+    static const int max_bins = 256;
+
+    /* Weighted class counts of each bin, stored bin after bin. */
+    typedef std::vector<double> Histogram;
+
+    /* Histograms of the records of a node, indexed by column (empty for
+     * the columns that have not been evaluated). */
+    typedef std::vector<Histogram> Histograms;
+
+    /** 
+     * @param data Records to quantize.
+     * @param nbins Maximum number of bins per attribute (up to max_bins).
+     */
+    explicit BinnedColumns(const Dataframe& data, int nbins=max_bins);
+
+    /** 
+     * @return Bin of the given row (of the root table) in column.
+     */
+    std::uint8_t get_bin(int column, int row) const
+    {
+      return bins_[column][row];
+    }
+
+    int get_nbins(int column) const
+    {
+      return lower_[column].size();
+    }
+
+    int get_nclasses() const
+    {
+      return nclasses_;
+    }
+
+    /** 
+     * @return Threshold separating the values of bin_l from those of bin_r
+     * (with bin_l < bin_r).
+     */
+    double get_threshold(int column, int bin_l, int bin_r) const
+    {
+      return (upper_[column][bin_l] + lower_[column][bin_r])/2;
+    }
+
+    /** 
+     * @brief Computes the class histogram of the records of data in column.
+     */
+    void histogram(const Dataframe& data, int column, Histogram& hist) const;
+
+    /** 
+     * @brief Turns the histogram of some records into the histogram of the
+     * rest of the records of their parent (histogram subtraction).
+     */
+    static void complement(const Histogram& parent, Histogram& hist);
+
+  private:
+
+    std::vector<std::vector<std::uint8_t>> bins_;
+    /* Lowest and highest value of each bin. */
+    std::vector<std::vector<double>> lower_, upper_;
+    int nclasses_;
+};
+
 class DecisionStump : public Stringifiable
 {
   public:
@@ -36,10 +262,26 @@ class DecisionStump : public Stringifiable
     DecisionStump(const Dataframe& data, int split) :
       attr_(data.get_attribute(split)), split_(split) {}
 
+    DecisionStump(const Attribute& attr, int split) :
+      attr_(attr), split_(split) {}
+
     virtual bool send_left(const Instance& instance) const = 0;
 
+    /** 
+     * @brief Reorders rows of root (the table the stump was trained on) so
+     * that those that go left come first, keeping the relative order of the
+     * rows on each side.
+     *
+     * @param scratch Buffer of at least end - begin rows, overwritten.
+     * @return End of the rows that go left.
+     */
+    virtual int* partition(const Table& root, int* begin, int* end,
+        int* scratch) const = 0;
+
     const Attribute& get_attribute() const { return attr_; }
 
+    int get_split() const { return split_; }
+
     double get_m() const { return m_lowest_; }
 
     virtual void to_json(json& stump) const;
@@ -62,10 +304,47 @@ class NumericDecisionStump : public DecisionStump
 
     NumericDecisionStump(json& stump);
 
-    NumericDecisionStump(const Dataframe& data, int split, Metric metric,
-        Dataframe::Ptr& left, Dataframe::Ptr& right);
+    NumericDecisionStump(const std::string& name, int split, double thr) :
+      DecisionStump(Attribute{name, true}, split), thr_(thr) {}
+
+    /** 
+     * Finds the best threshold of split for the records of data (which are
+     * not partitioned, see partition). If no threshold separates the values
+     * of split (e.g. all of them are missing but one), get_m() is inf.
+     *
+     * Criterion is one of the criteria above.
+     */
+    template <class Criterion>
+    NumericDecisionStump(const Dataframe& data, int split,
+        const Criterion& criterion);
+
+    /** 
+     * @param sorted Rows of the records of data, sorted by split (missing
+     * values last).
+     */
+    template <class Criterion>
+    NumericDecisionStump(const Dataframe& data, int split,
+        const Criterion& criterion, const std::vector<int>& sorted);
+
+    /** 
+     * @param hist Class histogram of the records of data in split. Only the
+     * boundaries between its bins are considered as thresholds. If the
+     * records fall in a single bin, get_m() is inf.
+     */
+    template <class Criterion>
+    NumericDecisionStump(const Dataframe& data, int split,
+        const Criterion& criterion, const BinnedColumns& binned,
+        const BinnedColumns::Histogram& hist);
 
     virtual bool send_left(const Instance& instance) const override;
+
+    virtual int* partition(const Table& root, int* begin, int* end,
+        int* scratch) const override;
+
+    /** 
+     * @return Records whose value is lower than this threshold go left.
+     */
+    double get_threshold() const { return thr_; }
     
     virtual void to_json(json& stump) const override;
 
@@ -73,28 +352,74 @@ class NumericDecisionStump : public DecisionStump
 
   private:
 
+    template <class Criterion>
+    void fit(const Dataframe& data, const std::vector<int>& sorted,
+        const Criterion& criterion);
+
     double thr_;
 
 };
 
+/** 
+ * @brief Split of a nominal attribute between a subset of its categories,
+ * which go left, and the rest (including unknown categories).
+ */
 class CategoricalDecisionStump : public DecisionStump
 {
   public:
 
     CategoricalDecisionStump(json& stump);
 
-    CategoricalDecisionStump(const Dataframe& data, int split, Metric metric,
-        Dataframe::Ptr& left, Dataframe::Ptr& right);
+    CategoricalDecisionStump(const std::string& name, int split,
+        const std::vector<std::string>& to_left);
+
+    /** 
+     * Records are counted per category and class in a single pass. The
+     * categories are then sorted by their proportion of the most frequent
+     * class, and every split between a prefix of that order and the rest is
+     * evaluated, which finds the best subset for two classes (Breiman et
+     * al.). With more classes, splits of a single category against the rest
+     * are evaluated too. If the records have a single category, get_m() is
+     * inf.
+     */
+    template <class Criterion>
+    CategoricalDecisionStump(const Dataframe& data, int split,
+        const Criterion& criterion);
 
     virtual bool send_left(const Instance& instance) const override;
 
+    virtual int* partition(const Table& root, int* begin, int* end,
+        int* scratch) const override;
+
+    /** 
+     * @return Categories known to the stump (those of the records it was
+     * trained on, or those sent left if it was loaded).
+     */
+    const Dictionary& get_categories() const { return categories_; }
+
+    /** 
+     * @return Whether the category with the given code in get_categories()
+     * goes left.
+     */
+    bool is_left(Code code) const { return to_left_[code]; }
+
+    /** 
+     * @return Categories that go left, in the order of get_categories().
+     */
+    std::vector<std::string> get_to_left() const;
+
     virtual void to_json(json& stump) const override;
 
     virtual std::string to_str() const override;
 
   private:
 
-    std::string to_left_;
+    Dictionary categories_;
+    /* Bitset of the categories that go left, indexed by Code. */
+    std::vector<bool> to_left_;
+    /* Same bitset indexed by the codes of the column the stump was trained
+     * on (empty if it was loaded). */
+    std::vector<bool> column_left_;
 
 };
 
@@ -106,10 +431,32 @@ class DecisionTree : public Stringifiable
 
     DecisionTree(json& tree);
 
-    DecisionTree(const Dataframe& data, int n, int f, Metric m);
-
-    DecisionTree(const Dataframe& data, int n, int f, Metric m,
-        const std::vector<int>& candidate_features);
+    /** 
+     * @brief Builds a leaf.
+     */
+    explicit DecisionTree(const std::string& guess) :
+      guess_(guess), stump_(nullptr), left_(nullptr), right_(nullptr) {}
+
+    /** 
+     * @brief Builds an inner node, taking ownership of its arguments.
+     */
+    DecisionTree(DecisionStump* stump, DecisionTree* left, DecisionTree* right) :
+      stump_(stump), left_(left), right_(right) {}
+
+    /** 
+     * @param sorted If not null, orders of (a superset of) the records of
+     * data, used for presorted split search.
+     * @param binned If not null, bins of (a superset of) the records of data,
+     * used for histogram split search.
+     */
+    DecisionTree(const Dataframe& data, int n, int f, Metric m, Rng& rng,
+        const SortedColumns* sorted=nullptr,
+        const BinnedColumns* binned=nullptr);
+
+    DecisionTree(const Dataframe& data, int n, int f, Metric m, Rng& rng,
+        const std::vector<int>& candidate_features,
+        const SortedColumns* sorted=nullptr,
+        const BinnedColumns* binned=nullptr);
 
     /* We do not need to copy trees. Delete default constructor so it is
      * not accidentally used. */
@@ -133,6 +480,20 @@ class DecisionTree : public Stringifiable
 
     std::string to_dot() const;
 
+    /** 
+     * @return Split of the root of this tree (null for a leaf).
+     */
+    const DecisionStump* get_stump() const { return stump_; }
+
+    const DecisionTree& get_left() const { return *left_; }
+
+    const DecisionTree& get_right() const { return *right_; }
+
+    /** 
+     * @return Class guessed by this tree if it is a leaf.
+     */
+    const std::string& get_guess() const { return guess_; }
+
     ~DecisionTree();
 
   private:
@@ -146,8 +507,24 @@ class DecisionTree : public Stringifiable
     static void filter_features(const Dataframe& data,
         const std::vector<int>& columns, std::vector<int>& filtered);
 
-    void fit(const Dataframe& data, int n, int f, Metric m,
-        const std::vector<int>& candidate_features);
+    DecisionTree() : stump_(nullptr), left_(nullptr), right_(nullptr) {}
+
+    /* Grows the tree with the criterion of m, on a copy of the rows of data
+     * that is partitioned in place as nodes split (through a scratch buffer
+     * of the same size, allocated once). */
+    void fit(const Dataframe& data, int n, int f, Metric m, Rng& rng,
+        const std::vector<int>& candidate_features,
+        SortedColumns::Ptr sorted, const BinnedColumns* binned);
+
+    /* In histogram mode, the histograms of the parent (if any) and the
+     * records of the sibling allow computing the histograms of this node by
+     * subtraction, scanning only the smallest of both. */
+    template <class Criterion>
+    void grow(const Slice& data, int n, int f, const Criterion& criterion,
+        Rng& rng, const std::vector<int>& candidate_features,
+        SortedColumns::Ptr sorted, const BinnedColumns* binned,
+        const BinnedColumns::Histograms* parent_hists,
+        const Dataframe* sibling, int* scratch);
 
     std::string guess_;
     DecisionStump* stump_;
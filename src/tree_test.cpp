@@ -1,15 +1,236 @@
 #include "imputation.h"
 #include "tree.h"
-#include <cstdlib>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <set>
 
 #ifndef DATA_PATH
 #define DATA_PATH "../Data/"
 #endif
 
+namespace
+{
+
+/* Whether both stumps split at the same threshold with the same impurity. */
+bool same_split(const sel::NumericDecisionStump& a,
+    const sel::NumericDecisionStump& b)
+{
+  if (a.get_m() == sel::inf or b.get_m() == sel::inf)
+  {
+    return a.get_m() == b.get_m();
+  }
+  return a.get_threshold() == b.get_threshold() and
+    std::abs(a.get_m() - b.get_m()) < 1e-12;
+}
+
+/* Whether the impurity that criterion keeps from running sums is that given
+ * by metric for the normalized counts, while class counts start from counts
+ * and records are then added and removed at random. */
+template <class Criterion>
+bool same_impurity(const Criterion& criterion, sel::Metric metric,
+    const sel::CategoryFrequency& counts, sel::Rng& rng)
+{
+  typename Criterion::State state;
+  sel::CategoryFrequency running(counts.size(), 0);
+  double total = 0;
+  bool same = true;
+  for (int step = 0; step < counts.size() + 100; ++step)
+  {
+    int class_ = step < counts.size()? step : rng.uniform(counts.size());
+    double weight = step < counts.size()? counts[class_] : 1;
+    if (step >= counts.size() and step%2 and running[class_] > 0) weight = -1;
+    criterion.update(state, running[class_], weight);
+    running[class_] += weight;
+    total += weight;
+    if (total <= 0) continue;
+    sel::CategoryFrequency probs(running);
+    for (double& prob : probs) prob /= total;
+    same = same and
+      std::abs(criterion.impurity(state, running, total) - metric(probs)) <
+      1e-9;
+  }
+  return same;
+}
+
+/* Impurity, by metric, of the split of the records of data that sends left
+ * those whose category in column has goes_left[code]. */
+double split_impurity(const sel::Dataframe& data, int column,
+    const std::vector<bool>& goes_left, sel::Metric metric)
+{
+  const sel::Table& root = data.get_root();
+  const sel::Column& categories = root.get_column(column);
+  const sel::Column& target = root.get_column(data.get_target_idx());
+  int nclasses = target.dictionary.size();
+  sel::CategoryFrequency sides[2] = {sel::CategoryFrequency(nclasses, 0),
+    sel::CategoryFrequency(nclasses, 0)};
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    int row = data.get_row(idx);
+    sides[goes_left[categories.codes[row]]? 0 : 1][target.codes[row]] += 1;
+  }
+  double m = 0;
+  for (sel::CategoryFrequency& side : sides)
+  {
+    double total = 0;
+    for (double count : side) total += count;
+    if (total == 0) continue;
+    for (double& count : side) count /= total;
+    m += total/data.get_nrecords()*metric(side);
+  }
+  return m;
+}
+
+/* Categories of column, by their code in the table, that stump sends left. */
+std::vector<bool> sent_left(const sel::CategoricalDecisionStump& stump,
+    const sel::Dataframe& data, int column)
+{
+  const sel::Dictionary& dictionary =
+    data.get_root().get_column(column).dictionary;
+  std::vector<bool> goes_left(dictionary.size(), false);
+  for (sel::Code code = 0; code < dictionary.size(); ++code)
+  {
+    long known = stump.get_categories().find(dictionary.decode(code));
+    goes_left[code] = known >= 0 and stump.is_left(known);
+  }
+  return goes_left;
+}
+
+/* Whether partition leaves in [rows.begin(), mid) the rows that stump
+ * sends left, and in [mid, rows.end()) the rest, both in their order in
+ * rows. */
+bool same_partition(const sel::DecisionStump& stump, const sel::Table& table,
+    std::vector<int> rows)
+{
+  std::vector<int> left, right;
+  for (int row : rows)
+  {
+    (stump.send_left(table.get_instance(row))? left : right).push_back(row);
+  }
+  std::vector<int> scratch(rows.size());
+  int* mid = stump.partition(table, rows.data(), rows.data() + rows.size(),
+      scratch.data());
+  return std::equal(left.begin(), left.end(), rows.data()) and
+    mid == rows.data() + left.size() and
+    std::equal(right.begin(), right.end(), mid);
+}
+
+/* Tree grown like DecisionTree did before its nodes were Slices of a single
+ * buffer of rows: each child is a View with a copy of the rows that the split
+ * of its parent sends its way, and the histograms of each node are computed
+ * from its own records. Random numbers are drawn in the same order. */
+sel::DecisionTree* grow_views(const sel::Dataframe& data, int n, int f,
+    sel::Rng& rng, const std::vector<int>& candidates,
+    const sel::BinnedColumns* binned)
+{
+  const sel::Table& root = data.get_root();
+  auto all_equal = [&](int column)
+  {
+    const sel::Column& values = root.get_column(column);
+    for (int idx = 1; idx < data.get_nrecords(); ++idx)
+    {
+      int row = data.get_row(idx), first = data.get_row(0);
+      if (data.get_attribute(column).numeric?
+          values.numbers[row] != values.numbers[first] :
+          values.codes[row] != values.codes[first]) return false;
+    }
+    return true;
+  };
+  auto mode = [&]()
+  {
+    sel::CategoryFrequency freq;
+    data.category_freq(data.get_target_idx(), freq, false);
+    const sel::Dictionary& classes =
+      root.get_column(data.get_target_idx()).dictionary;
+    std::string guess;
+    double max_occurrences = 0;
+    for (sel::Code code = 0; code < freq.size(); ++code)
+    {
+      if (freq[code] > max_occurrences)
+      {
+        guess = classes.decode(code);
+        max_occurrences = freq[code];
+      }
+    }
+    return new sel::DecisionTree(guess);
+  };
+  if (data.get_nrecords() < n) return mode();
+  if (all_equal(data.get_target_idx()))
+  {
+    return new sel::DecisionTree(
+        data.get_instance(0).get_category(data.get_target_idx()));
+  }
+  std::vector<int> filtered;
+  for (int column : candidates)
+  {
+    if (not all_equal(column)) filtered.push_back(column);
+  }
+  if (filtered.empty()) return mode();
+  int f_ = std::min(f, (int)filtered.size());
+  for (int idx = 0; idx < f_; ++idx)
+  {
+    std::swap(filtered[idx],
+        filtered[idx + rng.uniform(filtered.size() - idx)]);
+  }
+  sel::DecisionStump* best = nullptr;
+  for (int idx = 0; idx < f_; ++idx)
+  {
+    int column = filtered[idx];
+    sel::DecisionStump* stump;
+    if (data.get_attribute(column).numeric and binned)
+    {
+      sel::BinnedColumns::Histogram hist;
+      binned->histogram(data, column, hist);
+      stump = new sel::NumericDecisionStump(data, column,
+          sel::GiniCriterion(), *binned, hist);
+    }
+    else if (data.get_attribute(column).numeric)
+    {
+      stump = new sel::NumericDecisionStump(data, column,
+          sel::GiniCriterion());
+    }
+    else
+    {
+      stump = new sel::CategoricalDecisionStump(data, column,
+          sel::GiniCriterion());
+    }
+    if (stump->get_m() == sel::inf) delete stump;
+    else if (not best or stump->get_m() < best->get_m())
+    {
+      delete best;
+      best = stump;
+    }
+  }
+  if (not best) return mode();
+  std::vector<int> left_rows, right_rows;
+  for (int idx = 0; idx < data.get_nrecords(); ++idx)
+  {
+    (best->send_left(data.get_instance(idx))? left_rows : right_rows)
+      .push_back(data.get_row(idx));
+  }
+  if (left_rows.empty() or right_rows.empty())
+  {
+    delete best;
+    return mode();
+  }
+  sel::View left_data(root, std::move(left_rows), data.get_weights());
+  sel::View right_data(root, std::move(right_rows), data.get_weights());
+  sel::DecisionTree* left = grow_views(left_data, n, f, rng, filtered,
+      binned);
+  sel::DecisionTree* right = grow_views(right_data, n, f, rng, filtered,
+      binned);
+  return new sel::DecisionTree(best, left, right);
+}
+
+const char* yes_no(bool value)
+{
+  return value? "yes" : "no";
+}
+
+}
+
 int main(int argc, char* argv[])
 {
-  srand(42);
   if (argc != 2)
   {
     std::cerr << "Usage: " << argv[0] << " datasetname\n";
@@ -20,8 +241,6 @@ int main(int argc, char* argv[])
     std::string datafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".data";
     std::string metafile = std::string(DATA_PATH) + argv[1] + '/' + argv[1] + ".meta";
 
-    std::srand(42);
-
     sel::Table table(datafile, metafile);
     std::cout << table << std::endl;
 
@@ -38,7 +257,8 @@ int main(int argc, char* argv[])
     //std::cout << *left << std::endl;
     //std::cout << *right << std::endl;
     
-    sel::DecisionTree tree(table, 5, 3, sel::gini);
+    sel::Rng rng(42);
+    sel::DecisionTree tree(table, 5, 3, sel::gini, rng);
 
     //std::cout << tree << std::endl;
 
@@ -54,6 +274,221 @@ int main(int argc, char* argv[])
 
     std::cout << tree << std::endl;
     std::cout << tree2 << std::endl;
+
+    bool ok = true;
+    /* Presorted split search finds the thresholds of the exact one, for
+     * the whole table and for a subset whose orders are filtered from those
+     * of the table, and grows the same tree with the same random numbers. */
+    sel::SortedColumns sorted(table);
+    sel::View half(table, 0, table.get_nrecords()/2);
+    sel::SortedColumns half_sorted(sorted, half);
+    bool same = true;
+    for (int column = 0; column < table.get_nattributes(); ++column)
+    {
+      if (column == table.get_target_idx() or
+          not table.get_attribute(column).numeric) continue;
+      same = same and same_split(
+          sel::NumericDecisionStump(table, column, sel::GiniCriterion()),
+          sel::NumericDecisionStump(table, column, sel::GiniCriterion(),
+            sorted.get_order(column)));
+      same = same and same_split(
+          sel::NumericDecisionStump(half, column, sel::GiniCriterion()),
+          sel::NumericDecisionStump(half, column, sel::GiniCriterion(),
+            half_sorted.get_order(column)));
+    }
+    sel::Rng exact_rng(7), presorted_rng(7);
+    sel::DecisionTree exact_tree(table, 2, 3, sel::gini, exact_rng);
+    sel::DecisionTree presorted_tree(table, 2, 3, sel::gini, presorted_rng,
+        &sorted);
+    same = same and exact_tree.to_str() == presorted_tree.to_str();
+    std::cout << "Presorted split search matches the exact one: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* Histogram split search matches the exact one on the attributes with
+     * few enough values to have a bin each, and the histograms of the rest
+     * of a node are those of its parent minus those of a subset. */
+    sel::BinnedColumns binned(table);
+    sel::View other_half(table, 0, table.get_nrecords()/2, true);
+    same = true;
+    for (int column = 0; column < table.get_nattributes(); ++column)
+    {
+      if (column == table.get_target_idx() or
+          not table.get_attribute(column).numeric) continue;
+      sel::BinnedColumns::Histogram hist, half_hist, other_hist;
+      binned.histogram(table, column, hist);
+      binned.histogram(half, column, half_hist);
+      binned.histogram(other_half, column, other_hist);
+      sel::BinnedColumns::complement(hist, half_hist);
+      same = same and half_hist == other_hist;
+      std::set<double> values;
+      for (int idx = 0; idx < table.get_nrecords(); ++idx)
+      {
+        values.insert(table.get_instance(idx).get_number(column));
+      }
+      if (values.size() > sel::BinnedColumns::max_bins) continue;
+      same = same and same_split(
+          sel::NumericDecisionStump(table, column, sel::GiniCriterion()),
+          sel::NumericDecisionStump(table, column, sel::GiniCriterion(),
+            binned, hist));
+    }
+    std::cout << "Histogram split search matches the exact one: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* The criteria give the impurity of the Metric they stand for, and find
+     * the same splits as MetricCriterion with that Metric. */
+    sel::CategoryFrequency counts;
+    table.category_freq(table.get_target_idx(), counts, false);
+    same = same_impurity(sel::GiniCriterion(), sel::gini, counts, rng) and
+      same_impurity(sel::EntropyCriterion(), sel::entropy, counts, rng) and
+      same_impurity(sel::ErrorCriterion(), sel::error, counts, rng) and
+      same_impurity(sel::MetricCriterion(sel::gini), sel::gini, counts, rng);
+    for (int column = 0; column < table.get_nattributes(); ++column)
+    {
+      if (column == table.get_target_idx() or
+          not table.get_attribute(column).numeric) continue;
+      same = same and same_split(
+          sel::NumericDecisionStump(table, column, sel::GiniCriterion()),
+          sel::NumericDecisionStump(table, column,
+            sel::MetricCriterion(sel::gini)));
+      same = same and same_split(
+          sel::NumericDecisionStump(table, column, sel::EntropyCriterion()),
+          sel::NumericDecisionStump(table, column,
+            sel::MetricCriterion(sel::entropy)));
+      same = same and same_split(
+          sel::NumericDecisionStump(table, column, sel::ErrorCriterion()),
+          sel::NumericDecisionStump(table, column,
+            sel::MetricCriterion(sel::error)));
+    }
+    std::cout << "Criteria match their metrics: " << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* Categorical splits: with two classes (the records of the first two),
+     * the best of every subset of categories, for attributes with few
+     * enough of them; with all classes, at least as good as every split of
+     * one category against the rest. */
+    std::vector<int> two_classes;
+    const sel::Column& target = table.get_column(table.get_target_idx());
+    for (int row = 0; row < table.get_nrecords(); ++row)
+    {
+      if (target.codes[row] < 2) two_classes.push_back(row);
+    }
+    sel::View binary(table, std::move(two_classes));
+    same = true;
+    for (int column = 0; column < table.get_nattributes(); ++column)
+    {
+      if (column == table.get_target_idx() or
+          table.get_attribute(column).numeric) continue;
+      std::vector<sel::Code> present;
+      std::vector<bool> seen(table.get_column(column).dictionary.size());
+      for (int idx = 0; idx < binary.get_nrecords(); ++idx)
+      {
+        sel::Code code = table.get_column(column).codes[binary.get_row(idx)];
+        if (not seen[code]) present.push_back(code);
+        seen[code] = true;
+      }
+      sel::CategoricalDecisionStump stump(binary, column,
+          sel::GiniCriterion());
+      if (present.size() > 1 and present.size() <= 12)
+      {
+        /* The first category stays right, so each split is seen once. */
+        double lowest = sel::inf;
+        for (long subset = 1; subset < (1L << (present.size() - 1));
+            ++subset)
+        {
+          std::vector<bool> goes_left(seen.size(), false);
+          for (int idx = 1; idx < present.size(); ++idx)
+          {
+            goes_left[present[idx]] = subset >> (idx - 1) & 1;
+          }
+          lowest = std::min(lowest,
+              split_impurity(binary, column, goes_left, sel::gini));
+        }
+        same = same and std::abs(stump.get_m() - lowest) < 1e-9 and
+          std::abs(split_impurity(binary, column,
+                sent_left(stump, binary, column), sel::gini) - lowest) < 1e-9;
+      }
+      sel::CategoricalDecisionStump multiclass(table, column,
+          sel::GiniCriterion());
+      if (multiclass.get_m() == sel::inf) continue;
+      double m = split_impurity(table, column,
+          sent_left(multiclass, table, column), sel::gini);
+      same = same and std::abs(multiclass.get_m() - m) < 1e-9;
+      for (sel::Code code = 0; code < seen.size(); ++code)
+      {
+        std::vector<bool> goes_left(seen.size(), false);
+        goes_left[code] = true;
+        same = same and
+          m <= split_impurity(table, column, goes_left, sel::gini) + 1e-9;
+      }
+    }
+    std::cout << "Categorical splits are the best subsets for two classes "
+      "and beat one against the rest: " << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* Partitions of the rows (in random order) of the table keep the order
+     * of the rows that the stumps route each way, also for categorical
+     * stumps loaded from JSON. */
+    std::vector<int> shuffled(table.get_nrecords());
+    for (int idx = 0; idx < shuffled.size(); ++idx)
+    {
+      shuffled[idx] = idx;
+      std::swap(shuffled[idx], shuffled[rng.uniform(idx + 1)]);
+    }
+    same = true;
+    for (int column = 0; column < table.get_nattributes(); ++column)
+    {
+      if (column == table.get_target_idx()) continue;
+      if (table.get_attribute(column).numeric)
+      {
+        sel::NumericDecisionStump stump(table, column, sel::GiniCriterion());
+        if (stump.get_m() == sel::inf) continue;
+        same = same and same_partition(stump, table, shuffled);
+      }
+      else
+      {
+        sel::CategoricalDecisionStump stump(table, column,
+            sel::GiniCriterion());
+        if (stump.get_m() == sel::inf) continue;
+        sel::json stump_json;
+        stump.to_json(stump_json);
+        sel::CategoricalDecisionStump loaded(stump_json);
+        same = same and same_partition(stump, table, shuffled) and
+          same_partition(loaded, table, shuffled);
+      }
+    }
+    std::cout << "Partitions are stable and follow the stumps: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    /* Trees grown on Slices match those grown on Views, with exact and
+     * histogram split search (the latter subtracting the histograms of
+     * siblings from those of their parent). */
+    std::vector<int> candidates;
+    for (int column = 0; column < table.get_nattributes(); ++column)
+    {
+      if (column != table.get_target_idx()) candidates.push_back(column);
+    }
+    same = true;
+    for (const sel::BinnedColumns* bins : {(sel::BinnedColumns*)nullptr,
+        &binned})
+    {
+      sel::Rng slice_rng(11), view_rng(11);
+      sel::DecisionTree slice_tree(table, 2, 3, sel::gini, slice_rng, nullptr,
+          bins);
+      sel::DecisionTree::Ptr view_tree(grow_views(table, 2, 3, view_rng,
+            candidates, bins));
+      sel::json slice_json, view_json;
+      slice_tree.to_json(slice_json);
+      view_tree->to_json(view_json);
+      same = same and slice_json == view_json;
+    }
+    std::cout << "Trees grown on Slices match those grown on Views: "
+      << yes_no(same) << '\n';
+    ok = ok and same;
+
+    if (not ok) return 1;
   }
   catch (sel::SelException& ex)
   {